@@ -15,6 +15,7 @@
 #include <memory>
 #include <functional>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <cstring>
 #include <sstream>
 #include "llvm/IR/DerivedTypes.h"
@@ -22,6 +23,8 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
+#include "ir.h"
+#include "x86emitter.h"
 
 using namespace std;
 
@@ -31,17 +34,25 @@ static std::unique_ptr<llvm::IRBuilder<>> Builder;
 
 constexpr size_t TAPESIZE = 320'000;
 
+// Output is buffered by the generated program itself and written with write(2)
+// when the buffer is full and at exit. Prints at least this long are written
+// directly, after flushing the buffer.
+constexpr size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+// Input is read(2) this many bytes at a time, and Read only calls out once it is used up
+constexpr size_t INPUT_BUFFER_SIZE = 1 << 16;
+
 // Handle CLI arguments
 
 // https://blog.vito.nyc/posts/min-guide-to-cli/
-struct MySettings {
+struct MySettings : OptSettings {
   bool help{false};
-  bool simplifySimpleLoops {true};
-  bool vectorizeMemScans {false};
-  bool runInstCombine {true};
-  bool partialEval {false};
   bool justInTime {false};
   bool llvm {false};
+  bool lineBuffered {false};
+  size_t jitCodeCacheSize {256 << 20};
+  bool tiered {false};
+  size_t tierUpThreshold {100};
+  bool eagerJit {false};
   optional<string> infile;
   optional<string> outfile;
 };
@@ -62,6 +73,27 @@ bool stringToBool(string str) {
   }
 }
 
+size_t stringToSize(const string& str) {
+  if(str.empty() || !all_of(str.begin(), str.end(), ::isdigit)) {
+    cerr << "Unable to parse size " << str << ", exiting." << endl;
+    exit(-1);
+  }
+  return stoull(str);
+}
+
+EofBehavior stringToEofBehavior(const string& str) {
+  if(str == "unchanged")
+    return EofBehavior::Unchanged;
+  else if(str == "0")
+    return EofBehavior::Zero;
+  else if(str == "-1")
+    return EofBehavior::MinusOne;
+  else {
+    cerr << "Unable to parse end of input behavior " << str << " (unchanged, 0 or -1), exiting." << endl;
+    exit(-1);
+  }
+}
+
 typedef function<void(MySettings&)> NoArgHandle;
 
 #define S(str, f, v) {str, [](MySettings& s) {s.f = v;}}
@@ -77,6 +109,8 @@ typedef function<void(MySettings&, const string&)> OneArgHandle;
   {str, [](MySettings& s, const string& arg) { s.f = v; }}
 
 const unordered_map<string, OneArgHandle> OneArgs {
+  S("--fold-runs", foldRuns, stringToBool(arg)),
+
   S("--simplify-loops", simplifySimpleLoops, stringToBool(arg)),
 
   S("--vectorize-mem-scans", vectorizeMemScans, stringToBool(arg)),
@@ -85,10 +119,30 @@ const unordered_map<string, OneArgHandle> OneArgs {
 
   S("--partial-eval", partialEval, stringToBool(arg)),
 
+  S("--partial-eval-budget", partialEvalBudget, stringToSize(arg)),
+
+  S("--propagate-offsets", propagateOffsets, stringToBool(arg)),
+
+  S("--eliminate-dead-code", eliminateDeadCode, stringToBool(arg)),
+
+  S("--coalesce-writes", coalesceWrites, stringToBool(arg)),
+
   S("--just-in-time", justInTime, stringToBool(arg)),
 
   S("--llvm", llvm, stringToBool(arg)),
 
+  S("--line-buffered", lineBuffered, stringToBool(arg)),
+
+  S("--eof", eof, stringToEofBehavior(arg)),
+
+  S("--jit-code-cache-size", jitCodeCacheSize, stringToSize(arg)),
+
+  S("--tiered", tiered, stringToBool(arg)),
+
+  S("--tier-up-threshold", tierUpThreshold, stringToSize(arg)),
+
+  S("--eager-jit", eagerJit, stringToBool(arg)),
+
   S("-o", outfile, arg)
 };
 #undef S
@@ -129,1116 +183,870 @@ MySettings parse_settings(int argc, const char* const* const argv) {
 
 // end CLI arguments
 
-string hexToStr(const string& hex) {
-  size_t len = hex.length();
-  std::string newString;
-  for(size_t i=0; i< len; i+=2)
-  {
-      std::string byte = hex.substr(i,2);
-      char chr = static_cast<char>(static_cast<int>(strtol(byte.c_str(), nullptr, 16)));
-      newString.push_back(chr);
-  }
-
-  return newString;
-}
-
-enum Op {
-  MoveRight,
-  MoveLeft,
-  Inc,
-  Dec,
-  Write,
-  Read,
-  JumpIfZero,
-  JumpUnlessZero,
-  EndOfFile,
-  Zero,
-  Sum,
-  MulAdd,
-  AddMemPtr,
-  MemScan
-};
-
 string instrStr(const string& str) {
   return "\t" + str + "\n";
 }
 
-struct Instr {
-  virtual string str() const = 0;
-  virtual string assemble() const = 0;
-  virtual ~Instr() {}
-  Op op;
-};
-
-struct MoveRightInstr : public virtual Instr {
-  MoveRightInstr() {op = MoveRight;}
-
-  string str() const override {
-    return instrStr("inc\t%rdi");
-  }
-
-  string assemble() const override {
-    return hexToStr("48ffc7");
-  }
-};
-
-struct MoveLeftInstr : public virtual Instr {
-  MoveLeftInstr() {op = MoveLeft;}
-
-  string str() const override {
-    return instrStr("dec\t%rdi");
-  }
-
-  string assemble() const override {
-    return hexToStr("48ffcf");
-  }
-};
-
-struct IncInstr : public virtual Instr {
-  IncInstr() {op = Inc;}
-
-  string str() const override {
-    return instrStr("incb\t(%rdi)");
-  }
-
-  string assemble() const override {
-    return hexToStr("fe07");
-  }
-};
-
-struct DecInstr : public virtual Instr {
-  DecInstr() {op = Dec;}
-
-  string str() const override {
-    return instrStr("decb\t(%rdi)");
-  }
-
-  string assemble() const override {
-    return hexToStr("fe0f");
-  }
-};
-
-string getPtrRelOffset(intptr_t ptr1, intptr_t ptr2) {
-  intptr_t diff = ptr1 - ptr2;
-  stringstream ss;
-  ss << hex << diff;
-
-  string diffStr = ss.str();
-  if(diffStr.size() < 8)
-    diffStr = diffStr.insert(0, 8 - diffStr.size(), '0');
-  if(diffStr.size() > 8)
-    diffStr = diffStr.substr(diffStr.size() - 8, 8);
-
-  swap(diffStr[0], diffStr[6]);
-  swap(diffStr[1], diffStr[7]);
-  swap(diffStr[2], diffStr[4]);
-  swap(diffStr[3], diffStr[5]);
-
-  return diffStr;
+// Memory scans call one of these routines, chosen at startup by bf_init_scan.
+// Each checks width bytes per block, and handles strides up to width with
+// vector compares and larger ones one cell at a time.
+const array<pair<string, size_t>, 3> scanTiers{{{"sse2", 16}, {"avx2", 32}, {"avx512", 64}}};
+
+const string tapeOverflowMsg = "Overflowed tape size\n";
+const string tapeUnderflowMsg = "Underflowed tape size\n";
+
+// Leaves the mask of the zero bytes among the width at addr in %rax
+string scanZeroMaskAsm(const size_t width, const string& addr) {
+  if(width == 16)
+    return instrStr("movdqu\t"+addr+", %xmm0") + instrStr("pcmpeqb\t%xmm1, %xmm0") + instrStr("pmovmskb\t%xmm0, %eax");
+  if(width == 32)
+    return instrStr("vpcmpeqb\t"+addr+", %ymm1, %ymm0") + instrStr("vpmovmskb\t%ymm0, %eax");
+  return instrStr("vmovdqu8\t"+addr+", %zmm0") + instrStr("vptestnmb\t%zmm0, %zmm0, %k1") + instrStr("kmovq\t%k1, %rax");
 }
 
-struct WriteInstr : public virtual Instr {
-  WriteInstr() {op = Write;}
-
-  string str() const override {
-    string assembly;
-    assembly += instrStr("push\t%rdi");
-    assembly += instrStr("movb\t(%rdi), %dil");
-    assembly += instrStr("call\tputchar");
-    assembly += instrStr("pop\t%rdi");
-    return assembly;
-  }
-
-  string assemble() const override {
-      throw invalid_argument("This instruction can not assemble without parameter");
-    return hexToStr("57408a3fe8000000005f");
-  }
-  string assemble(unsigned char* startAddr) const {
-    intptr_t funcPtr = reinterpret_cast<intptr_t>(putchar);
-    intptr_t nextInstrAddr = reinterpret_cast<intptr_t>(startAddr) + 9;
-    string ptrRelOffset = getPtrRelOffset(funcPtr, nextInstrAddr);
-
-    // in addition to above assembly, must also push rsi and pop it
-    return hexToStr("5756408a3fe8"+ptrRelOffset+"5e5f");
-  }
-};
-
-struct ReadInstr : public virtual Instr {
-  ReadInstr() {op = Read;}
-
-  string str() const override {
-    string assembly;
-    assembly += instrStr("push\t%rdi");
-    assembly += instrStr("call\tgetchar");
-    assembly += instrStr("pop\t%rdi");
-    assembly += instrStr("movb\t%al, (%rdi)");
-    return assembly;
-  }
-
-  string assemble() const override {
-    throw invalid_argument("This instruction can not assemble currently");
-  }
-
-  string assemble(unsigned char* startAddr) const {
-    intptr_t funcPtr = reinterpret_cast<intptr_t>(getchar);
-    intptr_t nextInstrAddr = reinterpret_cast<intptr_t>(startAddr) + 6;
-    string ptrRelOffset = getPtrRelOffset(funcPtr, nextInstrAddr);
-
-    // in addition to above assembly, must also push rsi and pop it
-    return hexToStr("5756e8"+ptrRelOffset+"5e5f8807");
-  }
-};
-
-struct JumpInstr : public virtual Instr {
-  
-  // returns own label and target label
-  pair<string, string> getLabels() const {
-    return {ownLabel, targetLabel};
-  }
-
-  void setZeroTarget(unsigned char* ptr) {
-    jumpOnZeroTarget = ptr;
-  }
-
-  void setNotZeroTarget(unsigned char* ptr) {
-    jumpNotZeroTarget = ptr;
-  }
-
-  void setInstrStartAddr(unsigned char* ptr) {
-    instrStartAddr = ptr;
-  }
-
-  void setBBNum(size_t num) {
-    bbNum = num;
-  }
-
-protected:
-  string ownLabel, targetLabel;
-  unsigned char* jumpOnZeroTarget = nullptr;
-  unsigned char* jumpNotZeroTarget = nullptr;
-  unsigned char* instrStartAddr = nullptr;
-  size_t bbNum;
-};
-
-struct JumpIfZeroInstr : public virtual JumpInstr {
-  JumpIfZeroInstr(const string& iOwnLabel, const string& iTargetLabel)
-                {op = JumpIfZero; ownLabel = iOwnLabel; targetLabel = iTargetLabel; }
-
-  string str() const override {
-    string assembly;
-    assembly += ownLabel + ":\n";
-    assembly += instrStr("cmpb\t$0, (%rdi)");
-    assembly += instrStr("je\t"+targetLabel);
-    return assembly;
-  }
-
-  // returns with 13 no-ops (what will be filled in later)
-  string assemble() const override {
-    long bbIndexLong = static_cast<long>(bbNum);
-    string indexToLittleEndianHex = getPtrRelOffset(reinterpret_cast<intptr_t>(bbIndexLong), 0);
-    // mov DWORD PTR [rsi], bbIndex     ; Moves 4 bytes (32 bits) to the address in rsi
-    const string getBBNumObjCode = "c706" + indexToLittleEndianHex;
-
-
-    if(!jumpOnZeroTarget && !jumpNotZeroTarget) {
-      string noOpStr;
-      for(size_t i = 0; i < 24; ++i)
-        noOpStr += "90";
-
-      // intel syntax:
-      // mov    rax,rdi
-      // ret
-      return hexToStr(getBBNumObjCode+"4889f8c3"+noOpStr);  
-    }
-    else if(jumpOnZeroTarget && !jumpNotZeroTarget) {
-      intptr_t instrAfterJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 18;
-      intptr_t jzTarget = reinterpret_cast<intptr_t>(jumpOnZeroTarget);
-      string ptrRelOffset = getPtrRelOffset(jzTarget, instrAfterJumpPtr);
-
-      // intel syntax:
-      // cmp    BYTE PTR [rdi],0x0
-      // je     ptrRelOffset
-      // ret
-      return hexToStr(getBBNumObjCode+"4889f8803f000f84"+ptrRelOffset+"c3");  
-    }
-    else if(!jumpOnZeroTarget && jumpNotZeroTarget) {
-      intptr_t instrAfterJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 18;
-      intptr_t jnzTarget = reinterpret_cast<intptr_t>(jumpNotZeroTarget);
-      string ptrRelOffset = getPtrRelOffset(jnzTarget, instrAfterJumpPtr);
-
-      // intel syntax:
-      // cmp    BYTE PTR [rdi],0x0
-      // jne    ptrRelOffset
-      // ret
-      return hexToStr(getBBNumObjCode+"4889f8803f000f85"+ptrRelOffset+"c3");  
-    }
-    else { // both 
-      intptr_t instrAfterJzJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 18;
-      intptr_t instrAfterJnzJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 23;
-      intptr_t jzTarget = reinterpret_cast<intptr_t>(jumpOnZeroTarget);
-      intptr_t jnzTarget = reinterpret_cast<intptr_t>(jumpNotZeroTarget);
-      string jzTargetRelOffset = getPtrRelOffset(jzTarget, instrAfterJzJumpPtr);
-      string jnzTargetRelOffset = getPtrRelOffset(jnzTarget, instrAfterJnzJumpPtr);
-
-      // intel syntax:
-      // cmp    BYTE PTR [rdi],0x0
-      // je     jzTargetRelOffset
-      // jmp    jnzTargetRelOffset
-      return hexToStr(getBBNumObjCode+"4889f8803f000f84"+jzTargetRelOffset+"e9"+jnzTargetRelOffset);  
-    }
-  }
-};
-
-struct JumpUnlessZeroInstr : public virtual JumpInstr {
-  JumpUnlessZeroInstr(const string& iOwnLabel, const string& iTargetLabel)
-                {op = JumpUnlessZero; ownLabel = iOwnLabel; targetLabel = iTargetLabel; }
-
-  string str() const override {
-    string assembly;
-    assembly += ownLabel + ":\n";
-    assembly += instrStr("cmpb\t$0, (%rdi)");
-    assembly += instrStr("jne\t"+targetLabel);
-    return assembly;
-  }
-
-  // returns with 13 no-ops (what will be filled in later)
-  string assemble() const override {
-    long bbIndexLong = static_cast<long>(bbNum);
-    string indexToLittleEndianHex = getPtrRelOffset(reinterpret_cast<intptr_t>(bbIndexLong), 0);
-    // mov DWORD PTR [rsi], bbIndex     ; Moves 4 bytes (32 bits) to the address in rsi
-    const string getBBNumObjCode = "c706" + indexToLittleEndianHex;
-
-    if(!jumpOnZeroTarget && !jumpNotZeroTarget) {
-      string noOpStr;
-      for(size_t i = 0; i < 24; ++i)
-        noOpStr += "90";
-      
-      // intel syntax:
-      // mov    rax,rdi
-      // ret
-      return hexToStr(getBBNumObjCode+"4889f8c3"+noOpStr);  
-    }
-    else if(jumpOnZeroTarget && !jumpNotZeroTarget) {
-      throw std::invalid_argument("This should not be possible");
-    }
-    else if(!jumpOnZeroTarget && jumpNotZeroTarget) {
-      intptr_t instrAfterJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 18;
-      intptr_t jnzTarget = reinterpret_cast<intptr_t>(jumpNotZeroTarget);
-      string ptrRelOffset = getPtrRelOffset(jnzTarget, instrAfterJumpPtr);
-
-      // intel syntax:
-      // cmp    BYTE PTR [rdi],0x0
-      // jne    ptrRelOffset
-      // ret
-      return hexToStr(getBBNumObjCode+"4889f8803f000f85"+ptrRelOffset+"c3");  
-    }
-    else { // both 
-      intptr_t instrAfterJzJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 18;
-      intptr_t instrAfterJnzJumpPtr = reinterpret_cast<intptr_t>(instrStartAddr) + 23;
-      intptr_t jzTarget = reinterpret_cast<intptr_t>(jumpOnZeroTarget);
-      intptr_t jnzTarget = reinterpret_cast<intptr_t>(jumpNotZeroTarget);
-      string jzTargetRelOffset = getPtrRelOffset(jzTarget, instrAfterJzJumpPtr);
-      string jnzTargetRelOffset = getPtrRelOffset(jnzTarget, instrAfterJnzJumpPtr);
-
-      // intel syntax:
-      // cmp    BYTE PTR [rdi],0x0
-      // je     jzTargetRelOffset
-      // jmp    jnzTargetRelOffset
-      return hexToStr(getBBNumObjCode+"4889f8803f000f84"+jzTargetRelOffset+"e9"+jnzTargetRelOffset);  
-    }
-  }
-};
-
-struct EndOfFileInstr : public virtual Instr {
-  EndOfFileInstr() {op = EndOfFile;}
-
-  string str() const override {
-    return instrStr("ret");
-  }
-
-  string assemble() const override {
-    long bbIndexLong = static_cast<long>(bbNum);
-    string indexToLittleEndianHex = getPtrRelOffset(reinterpret_cast<intptr_t>(bbIndexLong), 0);
-    // mov DWORD PTR [rsi], bbIndex     ; Moves 4 bytes (32 bits) to the address in rsi
-    const string getBBNumObjCode = "c706" + indexToLittleEndianHex;
-
-    return hexToStr(getBBNumObjCode + "c3");
-  }
-
-  void setBBNum(size_t num) {
-    bbNum = num;
-  }
-
-private:
-  size_t bbNum;
-};
-
-struct ZeroInstr : public virtual Instr {
-  ZeroInstr() {op = Zero;}
-
-  string str() const override {
-    return instrStr("movb\t$0, (%rdi)");
-  }
-
-  string assemble() const override {
-    throw invalid_argument("This instruction can not assemble currently");
-  }
-};
-
-struct SumInstr : public virtual Instr {
-  SumInstr(const int64_t amount, const int64_t offset)
-          : amount(amount), offset(offset) {op = Sum;}
-
-  string str() const override {
-    const string offsetStr = (offset == 0) ? "" : to_string(offset);
-    
-    return instrStr("addb\t$"+to_string(amount)+", "+offsetStr+"(%rdi)");
-  }
-
-  string assemble() const override {
-    throw invalid_argument("This instruction can not assemble currently");
-  }
-
-  pair<int64_t, int64_t> amountAndOffset() const {
-    return {amount, offset};
-  }
-private:
-  int64_t amount;
-  int64_t offset;
-};
-
-struct MulAddInstr : public virtual Instr {
-  MulAddInstr(const int64_t amount, const int64_t offset, const bool posInc)
-          : amount(amount), offset(offset), posInc(posInc) {op = MulAdd;}
-
-  string str() const override {
-    const string offsetStr = (offset == 0) ? "" : to_string(offset);
-    string assembly;
-    assembly += instrStr("movb\t(%rdi), %al");
-    if(posInc) {
-      assembly += instrStr("xorb\t$-1, %al");
-      assembly += instrStr("addb\t$1, %al");
-    }
-    assembly += instrStr("movb\t$"+to_string(amount)+", %r10b");
-    assembly += instrStr("mulb\t%r10b");
-    assembly += instrStr("addb\t%al, "+offsetStr+"(%rdi)");
-    return assembly;
-  }
-
-  string assemble() const override {
-    throw invalid_argument("This instruction can not assemble currently");
-  }
-
-  tuple<int64_t, int64_t, bool> amountOffsetPosInc() const {
-    return {amount, offset, posInc};
-  }
-
-private:
-  int64_t amount;
-  int64_t offset;
-  bool posInc;
-};
-
-struct AddMemPointerInstr : public virtual Instr {
-  AddMemPointerInstr(const int64_t amount)
-          : amount(amount) {op = AddMemPtr;}
-
-  string str() const override {    
-    return instrStr("add\t$"+to_string(amount)+", %rdi");
-  }
-
-  string assemble() const override {
-    throw invalid_argument("This instruction can not assemble currently");
-  }
-
-  int64_t getAmount() const {
-    return amount;
+/**
+ * @brief Routine moving the tape pointer %rbx to the first zero cell at or past it in steps
+ *        of %rsi cells, forward or backward. Blocks are only loaded when they lie within the tape, so the
+ *        cells near its ends are checked one at a time. The stride picks the mask of the cells
+ *        to check in a block, and how far to move to the next one.
+ */
+string scanRoutineAsm(const string& tier, const size_t width, const bool backward) {
+  const string direction = backward ? "bwd" : "fwd";
+  const string name = "bf_scan_" + direction + "_" + tier;
+  const string scalar = "bf_scan_" + direction + "_scalar";
+  const string w = to_string(width), lastByte = to_string(width - 1);
+  const string vzeroupper = (width == 16) ? "" : instrStr("vzeroupper");
+
+  string assembly = name + ":\n";
+  assembly += instrStr("mov\tbf_tape_begin(%rip), %rdx");
+  if(!backward)
+    assembly += instrStr("add\t$"+to_string(TAPESIZE)+", %rdx");
+  assembly += instrStr("cmp\t$"+w+", %esi");
+  assembly += instrStr("ja\t"+scalar);
+  assembly += instrStr("lea\t.BFSCANMASK"+string(backward ? "BWD" + w : "FWD")+"(%rip), %rcx");
+  assembly += instrStr("mov\t-8(%rcx,%rsi,8), %r8");
+  assembly += instrStr("lea\t.BFSCANSTEP"+w+"(%rip), %rcx");
+  assembly += instrStr("movzbl\t-1(%rcx,%rsi), %r9d");
+  // the last block start that keeps the whole block on the tape
+  assembly += instrStr("lea\t"+string(backward ? lastByte : "-" + w)+"(%rdx), %r11");
+  if(width == 16)
+    assembly += instrStr("pxor\t%xmm1, %xmm1");
+  else if(width == 32)
+    assembly += instrStr("vpxor\t%xmm1, %xmm1, %xmm1");
+
+  assembly += ".L" + name + "_loop:\n";
+  assembly += instrStr("cmp\t%r11, %rbx");
+  assembly += instrStr(string(backward ? "jb" : "ja")+"\t.L"+name+"_tail");
+  assembly += scanZeroMaskAsm(width, backward ? "-" + lastByte + "(%rbx)" : "(%rbx)");
+  assembly += instrStr("and\t%r8, %rax");
+  assembly += instrStr("jnz\t.L"+name+"_found");
+  assembly += instrStr(string(backward ? "sub" : "add")+"\t%r9, %rbx");
+  assembly += instrStr("jmp\t.L"+name+"_loop");
+
+  assembly += ".L" + name + "_found:\n";
+  if(backward) {
+    assembly += instrStr("bsr\t%rax, %rax");
+    assembly += instrStr("lea\t-"+lastByte+"(%rbx,%rax), %rbx");
   }
-private:
-  int64_t amount;
-};
-
-
-struct MemScanInstr : public virtual Instr {
-  MemScanInstr(const int64_t stride)
-          : absoluteStride(abs(stride)), isNeg(stride < 0) {
-    op = MemScan;
-
-    if(!validStride(stride))
-      throw invalid_argument("Memscan stride of " + to_string(stride) + " is not supported");
+  else {
+    assembly += instrStr("bsf\t%rax, %rax");
+    assembly += instrStr("add\t%rax, %rbx");
   }
+  assembly += vzeroupper;
+  assembly += instrStr("ret");
 
-  string str() const override {
-    string assembly;
-    assembly += instrStr("vpxor\t%xmm0, %xmm0, %xmm0");
+  assembly += ".L" + name + "_tail:\n";
+  assembly += vzeroupper;
+  assembly += instrStr("jmp\t"+scalar);
 
-    if(isNeg) {
-      assembly += instrStr("mov\t%rdi, %r10");
-      assembly += instrStr("sub\t$31, %r10");
-      assembly += instrStr("vpcmpeqb\t(%r10), %ymm0, %ymm0");
-    }
-    else
-      assembly += instrStr("vpcmpeqb\t(%rdi), %ymm0, %ymm0");
+  return assembly;
+}
 
-    if(absoluteStride != 1) {
-      const string maskLabel = ".STRIDE" + to_string(absoluteStride) + "MASK" + ((isNeg) ? "NEG" : "");
-      assembly += instrStr("vpand\t"+maskLabel+"(%rip), %ymm0, %ymm0");
+// Tables indexed by stride - 1: the cells to check in a block, as a bitmask,
+// and how far to move to the next block so it starts on a cell to check
+string scanTablesAsm() {
+  string assembly = instrStr(".section\t.rodata") + instrStr(".p2align\t3");
+
+  assembly += ".BFSCANMASKFWD:\n";
+  for(size_t stride = 1; stride <= 64; ++stride) {
+    uint64_t mask = 0;
+    for(size_t bit = 0; bit < 64; bit += stride)
+      mask |= uint64_t{1} << bit;
+    assembly += instrStr(".quad\t"+to_string(mask));
+  }
+
+  for(const auto& [tier, width] : scanTiers) {
+    assembly += ".BFSCANMASKBWD" + to_string(width) + ":\n";
+    for(size_t stride = 1; stride <= width; ++stride) {
+      uint64_t mask = 0;
+      for(size_t bit = 0; bit < width; bit += stride)
+        mask |= uint64_t{1} << (width - 1 - bit);
+      assembly += instrStr(".quad\t"+to_string(mask));
     }
 
-    assembly += instrStr("vpmovmskb\t%ymm0, %r10");
-    if(isNeg) {
-      assembly += instrStr("lzcntl\t%r10d, %r10d");
-      assembly += instrStr("sub\t%r10, %rdi");
-    }
-    else{ 
-      assembly += instrStr("tzcntl\t%r10d, %r10d");
-      assembly += instrStr("add\t%r10, %rdi");
-    }
-    return assembly;
+    assembly += ".BFSCANSTEP" + to_string(width) + ":\n";
+    for(size_t stride = 1; stride <= width; ++stride)
+      assembly += instrStr(".byte\t"+to_string(width / stride * stride));
   }
 
-  string assemble() const override {
-    throw invalid_argument("This instruction can not assemble currently");
-  }
+  // the messages end in a newline, which the assembler needs escaped
+  assembly += ".BFOVERFLOWMSG:\n" + instrStr(".ascii\t\""+tapeOverflowMsg.substr(0, tapeOverflowMsg.size() - 1)+"\\n\"");
+  assembly += ".BFUNDERFLOWMSG:\n" + instrStr(".ascii\t\""+tapeUnderflowMsg.substr(0, tapeUnderflowMsg.size() - 1)+"\\n\"");
 
-  static constexpr bool validStride(const int64_t stride) {
-    return stride == 1 || stride == 2 || stride == 4 || stride == -1 || stride == -2 || stride == -4;
-  }
+  assembly += instrStr(".data") + instrStr(".p2align\t3");
+  assembly += "bf_tape_begin:\n" + instrStr(".quad\t0");
+  assembly += "bf_scan_fwd:\n" + instrStr(".quad\t0");
+  assembly += "bf_scan_bwd:\n" + instrStr(".quad\t0");
 
-  int64_t getStride() const {
-    return isNeg ? -absoluteStride : absoluteStride;
-  }
-private:
-  int64_t absoluteStride;
-  bool isNeg;
-};
+  return assembly + instrStr(".text");
+}
 
+string setScanRoutinesAsm(const string& tier) {
+  return instrStr("lea\tbf_scan_fwd_"+tier+"(%rip), %rax") + instrStr("mov\t%rax, bf_scan_fwd(%rip)") +
+         instrStr("lea\tbf_scan_bwd_"+tier+"(%rip), %rax") + instrStr("mov\t%rax, bf_scan_bwd(%rip)");
+}
 
-array<char, EndOfFile> enumToChar{{'>', '<', '+', '-', '.', ',', '[', ']'}};
+// Picks the widest scan routines that both the CPU and the OS support
+string scanInitAsm() {
+  string assembly = "bf_init_scan:\n";
+  assembly += instrStr("push\t%rbx");
+  assembly += setScanRoutinesAsm("sse2");
+
+  // leaf 7 must exist, and the OS must save ymm state (and zmm for AVX-512)
+  assembly += instrStr("xor\t%eax, %eax");
+  assembly += instrStr("cpuid");
+  assembly += instrStr("cmp\t$7, %eax");
+  assembly += instrStr("jb\t.Lbf_init_scan_done");
+  assembly += instrStr("mov\t$1, %eax");
+  assembly += instrStr("cpuid");
+  assembly += instrStr("bt\t$27, %ecx");
+  assembly += instrStr("jnc\t.Lbf_init_scan_done");
+  assembly += instrStr("xor\t%ecx, %ecx");
+  assembly += instrStr("xgetbv");
+  assembly += instrStr("mov\t%eax, %r8d");
+  assembly += instrStr("mov\t$7, %eax");
+  assembly += instrStr("xor\t%ecx, %ecx");
+  assembly += instrStr("cpuid");
+
+  assembly += instrStr("mov\t%r8d, %eax");
+  assembly += instrStr("and\t$6, %eax");
+  assembly += instrStr("cmp\t$6, %eax");
+  assembly += instrStr("jne\t.Lbf_init_scan_done");
+  assembly += instrStr("bt\t$5, %ebx");
+  assembly += instrStr("jnc\t.Lbf_init_scan_done");
+  assembly += setScanRoutinesAsm("avx2");
+
+  assembly += instrStr("mov\t%r8d, %eax");
+  assembly += instrStr("and\t$0xe0, %eax");
+  assembly += instrStr("cmp\t$0xe0, %eax");
+  assembly += instrStr("jne\t.Lbf_init_scan_done");
+  assembly += instrStr("bt\t$16, %ebx");
+  assembly += instrStr("jnc\t.Lbf_init_scan_done");
+  assembly += instrStr("bt\t$30, %ebx");
+  assembly += instrStr("jnc\t.Lbf_init_scan_done");
+  assembly += setScanRoutinesAsm("avx512");
+
+  assembly += ".Lbf_init_scan_done:\n";
+  assembly += instrStr("pop\t%rbx");
+  assembly += instrStr("ret");
 
-vector<Op> readFile(string fileName) {
-  ifstream fileStream(fileName);
+  return assembly;
+}
 
-  if(!fileStream.is_open()) {
-    cerr << "Unable to open file " << fileName << endl;
-    exit(-1);
-  }
+// One cell at a time scans for strides wider than a block and near the ends of
+// the tape, which report running off the tape like the interpreter does
+string scanScalarAsm() {
+  string assembly = "bf_scan_fwd_scalar:\n";
+  assembly += instrStr("cmp\t%rdx, %rbx");
+  assembly += instrStr("jae\tbf_tape_overflow");
+  assembly += instrStr("cmpb\t$0, (%rbx)");
+  assembly += instrStr("je\t.Lbf_scan_scalar_found");
+  assembly += instrStr("add\t%rsi, %rbx");
+  assembly += instrStr("jmp\tbf_scan_fwd_scalar");
+
+  assembly += "bf_scan_bwd_scalar:\n";
+  assembly += instrStr("cmp\t%rdx, %rbx");
+  assembly += instrStr("jb\tbf_tape_underflow");
+  assembly += instrStr("cmpb\t$0, (%rbx)");
+  assembly += instrStr("je\t.Lbf_scan_scalar_found");
+  assembly += instrStr("sub\t%rsi, %rbx");
+  assembly += instrStr("jmp\tbf_scan_bwd_scalar");
+
+  assembly += ".Lbf_scan_scalar_found:\n";
+  assembly += instrStr("ret");
+
+  // what the program printed so far comes before the error
+  assembly += "bf_tape_overflow:\n";
+  assembly += instrStr("call\tbf_flush_output");
+  assembly += instrStr("lea\t.BFOVERFLOWMSG(%rip), %rsi");
+  assembly += instrStr("mov\t$"+to_string(tapeOverflowMsg.size())+", %edx");
+  assembly += instrStr("jmp\tbf_tape_error");
+  assembly += "bf_tape_underflow:\n";
+  assembly += instrStr("call\tbf_flush_output");
+  assembly += instrStr("lea\t.BFUNDERFLOWMSG(%rip), %rsi");
+  assembly += instrStr("mov\t$"+to_string(tapeUnderflowMsg.size())+", %edx");
+  assembly += "bf_tape_error:\n";
+  assembly += instrStr("and\t$-16, %rsp");
+  assembly += instrStr("mov\t$2, %edi");
+  assembly += instrStr("call\twrite");
+  assembly += instrStr("mov\t$-1, %edi");
+  assembly += instrStr("call\texit");
 
-  vector<Op> retVec;
+  return assembly;
+}
 
-  char currChar;
-  while(fileStream.get(currChar)) {
-    switch(currChar) {
-      case '>':
-        retVec.push_back(MoveRight);
-        break;
-      case '<':
-        retVec.push_back(MoveLeft);
-        break;
-      case '+':
-        retVec.push_back(Inc);
-        break;
-      case '-':
-        retVec.push_back(Dec);
-        break;
-      case '.':
-        retVec.push_back(Write);
-        break;
-      case ',':
-        retVec.push_back(Read);
-        break;
-      case '[':
-        retVec.push_back(JumpIfZero);
-        break;
-      case ']':
-        retVec.push_back(JumpUnlessZero);
-        break;
-      default:
-        continue;
-    }
+string scanRuntimeAsm() {
+  string assembly = scanInitAsm() + scanScalarAsm();
+  for(const auto& [tier, width] : scanTiers) {
+    assembly += scanRoutineAsm(tier, width, false);
+    assembly += scanRoutineAsm(tier, width, true);
   }
-
-  retVec.push_back(EndOfFile);
-
-  return retVec;
+  return assembly;
 }
 
 /**
- * @brief Returns pair, first one going to matching brace, second one indicating current position's name
- * 
- * @param code 
- * @return pair<unordered_map<size_t, string>, unordered_map<size_t, string>> 
+ * @brief The output buffer and its routines:
+ *        bf_write_all writes %rdx bytes at %rsi to stdout, retrying short writes
+ *        bf_flush_output writes out and empties the buffer
+ *        bf_print appends %rdx bytes at %rsi to the buffer, or writes them directly
+ *        when they don't fit in it
+ *        Like every runtime routine, they keep the callee-saved registers, the tape
+ *        pointer %rbx among them, so calls to them need no spills. They align the
+ *        stack themselves, so they can be called at any depth.
  */
-pair<unordered_map<size_t, string>, unordered_map<size_t, string>> initializeLoopBracketLabels(const vector<Op>& code) {
-  stack<size_t> leftBrackLocs;
-  unordered_map<size_t, string> loopMap;
-  unordered_map<size_t, string> ownNameMap;
+string outputRuntimeAsm() {
+  const string bufferSize = to_string(OUTPUT_BUFFER_SIZE);
+
+  string assembly = instrStr(".bss") + instrStr(".p2align\t6");
+  assembly += "bf_out_buf:\n" + instrStr(".zero\t"+bufferSize);
+  assembly += "bf_out_len:\n" + instrStr(".zero\t8");
+  assembly += instrStr(".text");
+
+  assembly += "bf_write_all:\n";
+  assembly += instrStr("push\t%r12");
+  assembly += instrStr("push\t%r13");
+  assembly += instrStr("push\t%rbp");
+  assembly += instrStr("mov\t%rsp, %rbp");
+  assembly += instrStr("and\t$-16, %rsp");
+  assembly += instrStr("mov\t%rsi, %r12");
+  assembly += instrStr("mov\t%rdx, %r13");
+  assembly += ".Lbf_write_all_loop:\n";
+  assembly += instrStr("test\t%r13, %r13");
+  assembly += instrStr("jle\t.Lbf_write_all_done");
+  assembly += instrStr("mov\t$1, %edi");
+  assembly += instrStr("mov\t%r12, %rsi");
+  assembly += instrStr("mov\t%r13, %rdx");
+  assembly += instrStr("call\twrite");
+  assembly += instrStr("test\t%rax, %rax");
+  assembly += instrStr("jle\t.Lbf_write_all_done");
+  assembly += instrStr("add\t%rax, %r12");
+  assembly += instrStr("sub\t%rax, %r13");
+  assembly += instrStr("jmp\t.Lbf_write_all_loop");
+  assembly += ".Lbf_write_all_done:\n";
+  assembly += instrStr("mov\t%rbp, %rsp");
+  assembly += instrStr("pop\t%rbp");
+  assembly += instrStr("pop\t%r13");
+  assembly += instrStr("pop\t%r12");
+  assembly += instrStr("ret");
+
+  assembly += "bf_flush_output:\n";
+  assembly += instrStr("lea\tbf_out_buf(%rip), %rsi");
+  assembly += instrStr("mov\tbf_out_len(%rip), %rdx");
+  assembly += instrStr("movq\t$0, bf_out_len(%rip)");
+  assembly += instrStr("jmp\tbf_write_all");
+
+  assembly += "bf_print:\n";
+  assembly += instrStr("mov\tbf_out_len(%rip), %rax");
+  assembly += instrStr("add\t%rdx, %rax");
+  assembly += instrStr("cmp\t$"+bufferSize+", %rax");
+  assembly += instrStr("jbe\t.Lbf_print_copy");
+  assembly += instrStr("push\t%rsi");
+  assembly += instrStr("push\t%rdx");
+  assembly += instrStr("call\tbf_flush_output");
+  assembly += instrStr("pop\t%rdx");
+  assembly += instrStr("pop\t%rsi");
+  assembly += instrStr("cmp\t$"+bufferSize+", %rdx");
+  assembly += instrStr("jae\tbf_write_all");
+  assembly += ".Lbf_print_copy:\n";
+  assembly += instrStr("lea\tbf_out_buf(%rip), %rdi");
+  assembly += instrStr("add\tbf_out_len(%rip), %rdi");
+  assembly += instrStr("mov\t%rdx, %rcx");
+  assembly += instrStr("rep movsb");
+  assembly += instrStr("add\t%rdx, bf_out_len(%rip)");
+  assembly += instrStr("ret");
 
-  bool canBeInnerLoop = false;
-
-  size_t currLabelCounter = 0;
-
-  for(size_t i = 0; i < code.size(); ++i) {
-    if(code[i] == JumpIfZero) {
-      leftBrackLocs.push(i);
-
-      canBeInnerLoop = true;
-    }
-    else if(code[i] == JumpUnlessZero) {
-      const size_t lhs = leftBrackLocs.top();
-      loopMap[lhs] = "label" + to_string(currLabelCounter + 1);
-      loopMap[i] = "label" + to_string(currLabelCounter);
-      ownNameMap[lhs] = "label" + to_string(currLabelCounter);
-      ownNameMap[i] = "label" + to_string(currLabelCounter + 1);
-      currLabelCounter += 2;
-      leftBrackLocs.pop();
-    }
-  }
-
-  return {loopMap, ownNameMap};
+  return assembly;
 }
 
-string intializeVectorMasks() {
-  return ".STRIDE2MASK:\n" \
-	"\t.byte	255                             # 0xff\n" \
-  ".STRIDE2MASKNEG:\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-  "\t.byte	0                               # 0x0\n" \
-  "\t.byte	255                             # 0xff\n" \
-  ".STRIDE4MASK:\n" \
-	"\t.byte	255                             # 0xff\n" \
-  ".STRIDE4MASKNEG:\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n" \
-	"\t.byte	0                               # 0x0\n" \
-	"\t.byte	0                             # 0xff\n" \
-  "\t.byte	0                               # 0x0\n" \
-	"\t.byte	255                             # 0xff\n";
+/**
+ * @brief The input buffer Read takes bytes from inline. bf_read_refill reads the next block and returns its first byte in %eax. At end of input it
+ *        returns 0 with --eof 0, and -1 otherwise, which Read skips storing with --eof unchanged.
+ */
+string inputRuntimeAsm(const EofBehavior eof) {
+  string assembly = instrStr(".bss") + instrStr(".p2align\t6");
+  assembly += "bf_in_buf:\n" + instrStr(".zero\t"+to_string(INPUT_BUFFER_SIZE));
+  assembly += "bf_in_pos:\n" + instrStr(".zero\t8");
+  assembly += "bf_in_end:\n" + instrStr(".zero\t8");
+  assembly += instrStr(".text");
+
+  assembly += "bf_read_refill:\n";
+  assembly += instrStr("push\t%rbp");
+  assembly += instrStr("mov\t%rsp, %rbp");
+  assembly += instrStr("and\t$-16, %rsp");
+  assembly += instrStr("xor\t%edi, %edi");
+  assembly += instrStr("lea\tbf_in_buf(%rip), %rsi");
+  assembly += instrStr("mov\t$"+to_string(INPUT_BUFFER_SIZE)+", %edx");
+  assembly += instrStr("call\tread");
+  assembly += instrStr("test\t%rax, %rax");
+  assembly += instrStr("jle\t.Lbf_read_refill_eof");
+  assembly += instrStr("mov\t%rax, bf_in_end(%rip)");
+  assembly += instrStr("movq\t$1, bf_in_pos(%rip)");
+  assembly += instrStr("movzbl\tbf_in_buf(%rip), %eax");
+  assembly += instrStr("jmp\t.Lbf_read_refill_done");
+  assembly += ".Lbf_read_refill_eof:\n";
+  assembly += instrStr(eof == EofBehavior::Zero ? "xor\t%eax, %eax" : "mov\t$-1, %eax");
+  assembly += ".Lbf_read_refill_done:\n";
+  assembly += instrStr("mov\t%rbp, %rsp");
+  assembly += instrStr("pop\t%rbp");
+  assembly += instrStr("ret");
+
+  return assembly;
 }
 
-string initializeProgram() {
+// Programs that only print never touch the tape, so they don't allocate one
+string initializeProgram(const bool usesMemScan, const bool usesTape, const bool usesRead, const EofBehavior eof) {
   static_assert(TAPESIZE % 2 == 0, "Tapesize must be even to by symmetric");
+  const string tapeSetup = usesMemScan ? instrStr("movq\t%rax, bf_tape_begin(%rip)") + instrStr("call\tbf_init_scan") +
+                                         instrStr("movq\tbf_tape_begin(%rip), %rax")
+                                       : "";
   // use calloc to initialize all memory to 0
-  string vectorMasks = intializeVectorMasks();
-
-  return vectorMasks + ".global main\n"
-        "main:\n"
-        "\tsubq\t$8, %rsp\n"
+  const string tapeAllocation = !usesTape ? "" :
         "\tmovl\t$"+to_string(TAPESIZE)+", %edi\n"
         "\tmovl\t$1, %esi\n"
         "\tcall\tcalloc\n"
-        "\tleaq\t"+to_string(TAPESIZE/2)+"(%rax), %rdi\n"
+        + tapeSetup +
+        "\tleaq\t"+to_string(TAPESIZE/2)+"(%rax), %rbx\n";
+
+  // the tape pointer lives in %rbx, which is ours to restore, and pushing it aligns the stack
+  return (usesMemScan ? scanTablesAsm() : "") + ".global main\n"
+        "main:\n"
+        "\tpushq\t%rbx\n"
+        + tapeAllocation +
         "\tcall\tbf_main\n"
+        "\tcall\tbf_flush_output\n"
         "\tmovl\t$0, %eax\n"
-        "\taddq\t$8, %rsp\n"
+        "\tpopq\t%rbx\n"
         "\tret\n"
         "\n"
+        + outputRuntimeAsm() + "\n"
+        + (usesRead ? inputRuntimeAsm(eof) + "\n" : "")
+        + (usesMemScan ? scanRuntimeAsm() + "\n" : "") +
         "bf_main:\n";
 }
 
-vector<unique_ptr<Instr>> parse(const vector<Op>& ops) {
-  // Note: %rdi will hold the current index on the tape
-  // Except when calling putchar or getchar, then %rdi
-  // will be pushed onto the stack
-
-  const auto& [matchingBracketLabelMap, ownLabelMap] = initializeLoopBracketLabels(ops);
-  vector<unique_ptr<Instr>> instructions;
-
-  for(size_t IP = 0; IP < ops.size(); ++IP) {
-    const Op currInstr = ops[IP];
-
-    switch(currInstr) {
-      case MoveRight: {
-        instructions.push_back(make_unique<MoveRightInstr>());
-        break;
-      }
-      case MoveLeft: {
-        instructions.push_back(make_unique<MoveLeftInstr>());
-        break;
-      }
-      case Inc: {
-        instructions.push_back(make_unique<IncInstr>());
-        break;
-      }
-      case Dec: {
-        instructions.push_back(make_unique<DecInstr>());
-        break;
-      }
-      case Write: {
-        instructions.push_back(make_unique<WriteInstr>());
-        break;
-      }
-      case Read: {
-        instructions.push_back(make_unique<ReadInstr>());
-        break;
-      }
-      case JumpIfZero: {
-        const string thisLabel = ownLabelMap.at(IP);
-        const string targetLabel = matchingBracketLabelMap.at(IP);
-        instructions.push_back(make_unique<JumpIfZeroInstr>(thisLabel, targetLabel));
-        break;
-      }
-      case JumpUnlessZero: {
-        const string thisLabel = ownLabelMap.at(IP);
-        const string targetLabel = matchingBracketLabelMap.at(IP);
-        instructions.push_back(make_unique<JumpUnlessZeroInstr>(thisLabel, targetLabel));
-        break;
-      }
-      case EndOfFile: {
-        instructions.push_back(make_unique<EndOfFileInstr>());
-        break;
-      }
-      default: {
-        continue;
-      }
-    }
-  }
-
-  return instructions;
+string outputLabel(const uint32_t stringId) {
+  return ".BFOUTPUT" + to_string(stringId);
 }
 
-// Generates only instructions inside the loop, not loops brackets
-vector<unique_ptr<Instr>> generateSimplifiedLoopInstrs(const unordered_map<int64_t,int64_t>& incrementAtOffset) {
-  vector<unique_ptr<Instr>> newInstrs;
-
-  const int64_t inducInc = incrementAtOffset.at(0);
-
-  for(const auto& [offset, amount] : incrementAtOffset) {
-    if(offset == 0)
-      continue;
-    const bool posInc = inducInc > 0;
-    newInstrs.push_back(make_unique<MulAddInstr>(amount, offset, posInc));
+// Quoted for .ascii, with anything but printable characters as octal escapes
+string asciiLiteral(const string& str) {
+  string literal = "\"";
+  for(const char c : str) {
+    const auto byte = static_cast<unsigned char>(c);
+    if(c == '"' || c == '\\')
+      literal += string("\\") + c;
+    else if(byte >= ' ' && byte <= '~')
+      literal += c;
+    else {
+      literal += '\\';
+      literal += static_cast<char>('0' + (byte >> 6));
+      literal += static_cast<char>('0' + ((byte >> 3) & 7));
+      literal += static_cast<char>('0' + (byte & 7));
+    }
   }
-  newInstrs.push_back(make_unique<ZeroInstr>());
-
-  return newInstrs;
+  return literal + "\"";
 }
 
-// Generates loop brackets as well
-vector<unique_ptr<Instr>> generateMemScanInstructions(vector<unique_ptr<Instr>>& instrs, const size_t begin, const size_t end, const int64_t stride) {
-  vector<unique_ptr<Instr>> newInstrs;
-
-  newInstrs.push_back(std::move(instrs[begin]));
-  newInstrs.push_back(make_unique<MemScanInstr>(stride));
-  newInstrs.push_back(std::move(instrs[end - 1]));
+string outputsAsm(const vector<string>& outputs) {
+  if(outputs.empty())
+    return "";
 
-  return newInstrs;
+  string assembly = instrStr(".section\t.rodata");
+  for(size_t stringId = 0; stringId < outputs.size(); ++stringId)
+    assembly += outputLabel(static_cast<uint32_t>(stringId)) + ":\n" + instrStr(".ascii\t"+asciiLiteral(outputs[stringId]));
+  return assembly;
 }
 
-optional<vector<unique_ptr<Instr>>> checkSimpleOrMemScanLoop(vector<unique_ptr<Instr>>& instrs, const size_t begin, const size_t end, const MySettings& settings) {
-  int currMemOffset = 0;
-  unordered_map<int64_t, int64_t> incrementAtOffset;
-
-  for(size_t i = begin; i < end; ++i) {
-    const Op op = instrs.at(i)->op;
-    if(op == MoveRight)
-      ++currMemOffset;
-    else if(op == MoveLeft)
-      --currMemOffset;
-    else if(op == Inc)
-      ++incrementAtOffset[currMemOffset];
-    else if(op == Dec) 
-      --incrementAtOffset[currMemOffset];
-    else if(op == JumpIfZero || op == JumpUnlessZero)
-      continue;
-    else
-      return {};
-  }
-
-  // Memory scan loops that go up by 1 and don't change any values
-  if(settings.vectorizeMemScans && MemScanInstr::validStride(currMemOffset) && incrementAtOffset.empty())
-    return generateMemScanInstructions(instrs, begin, end, currMemOffset);
-
-  if(!settings.simplifySimpleLoops)
-    return {};
-
-  if(!incrementAtOffset.count(0))
-    return {};
-
-  const int64_t inducInc = incrementAtOffset.at(0);
-  if(inducInc != 1 && inducInc != -1)
-    return {};
-
-  if(currMemOffset != 0)
+/**
+ * @brief Instructions that multiply %eax by factor, keeping the low byte right. Shifts and
+ *        lea cover powers of two and 3, 5 and 9 times them, in up to two instructions,
+ *        and anything else takes an imul.
+ */
+vector<string> multiplyAsm(const uint8_t factor) {
+  vector<pair<uint8_t, string>> steps;
+  for(int shift = 1; shift < 8; ++shift)
+    steps.emplace_back(1 << shift, "shl\t$"+to_string(shift)+", %eax");
+  for(int scale : {2, 4, 8})
+    steps.emplace_back(scale + 1, "lea\t(%rax,%rax,"+to_string(scale)+"), %eax");
+
+  if(factor == 1)
     return {};
-
-  auto newLoopInstrs = generateSimplifiedLoopInstrs(incrementAtOffset);
-
-  return newLoopInstrs;
+  for(const auto& [multiplier, step] : steps)
+    if(multiplier == factor)
+      return {step};
+  for(const auto& [first, firstStep] : steps)
+    for(const auto& [second, secondStep] : steps)
+      if(static_cast<uint8_t>(first * second) == factor)
+        return {firstStep, secondStep};
+  return {"imul\t$"+to_string(static_cast<unsigned>(factor))+", %eax, %eax"};
 }
 
-
-vector<unique_ptr<Instr>> simplifyLoops(vector<unique_ptr<Instr>>& instrs, const MySettings& settings) {
-  if(!settings.simplifySimpleLoops && !settings.vectorizeMemScans)
-    return std::move(instrs);
-
-  bool canBeSimpleLoop = false;
-  size_t lhsIndex = 0;
-
-  for(size_t i = 0; i < instrs.size() - 2; ++i) {
-    if(instrs[i]->op == JumpIfZero) {
-      canBeSimpleLoop = true;
-      lhsIndex = i;
+string instrAsm(const Instr& instr, const MySettings& settings) {
+  const string offsetStr = (instr.offset == 0) ? "" : to_string(instr.offset);
+
+  switch(instr.op) {
+    case MoveRight:
+      return instrStr("inc\t%rbx");
+    case MoveLeft:
+      return instrStr("dec\t%rbx");
+    case Inc:
+      return instrStr("incb\t(%rbx)");
+    case Dec:
+      return instrStr("decb\t(%rbx)");
+    case Write: {
+      // append to the output buffer, and only call out to flush it
+      string assembly;
+      assembly += instrStr("movzbl\t"+offsetStr+"(%rbx), %eax");
+      assembly += instrStr("mov\tbf_out_len(%rip), %rcx");
+      assembly += instrStr("lea\tbf_out_buf(%rip), %rdx");
+      assembly += instrStr("movb\t%al, (%rdx,%rcx)");
+      assembly += instrStr("inc\t%rcx");
+      assembly += instrStr("mov\t%rcx, bf_out_len(%rip)");
+      if(settings.lineBuffered) {
+        assembly += instrStr("cmp\t$10, %al");
+        assembly += instrStr("je\t1f");
+      }
+      assembly += instrStr("cmp\t$"+to_string(OUTPUT_BUFFER_SIZE)+", %rcx");
+      assembly += instrStr("jb\t2f");
+      assembly += "1:\n";
+      assembly += instrStr("call\tbf_flush_output");
+      assembly += "2:\n";
+      return assembly;
     }
-    else if(instrs[i]->op == JumpUnlessZero && canBeSimpleLoop) {
-      auto loopInstr = checkSimpleOrMemScanLoop(instrs, lhsIndex, i + 1, settings);
-      if(loopInstr) {
-        long lhsIterOffset = static_cast<long>(lhsIndex);
-        long iterOffset = static_cast<long>(i);
-        auto& loopInstrs = loopInstr.value();
-
-        instrs.erase(instrs.begin() + lhsIterOffset, instrs.begin() + iterOffset + 1);
-        instrs.insert(instrs.begin() + lhsIterOffset, make_move_iterator(loopInstrs.begin()), make_move_iterator(loopInstrs.end()));
-        i = static_cast<size_t>(lhsIterOffset + (loopInstrs.end() - loopInstrs.begin()));
+    case Read: {
+      // take the next byte from the input buffer, and only call out to refill it
+      string assembly;
+      assembly += instrStr("mov\tbf_in_pos(%rip), %rcx");
+      assembly += instrStr("cmp\tbf_in_end(%rip), %rcx");
+      assembly += instrStr("jae\t1f");
+      assembly += instrStr("lea\tbf_in_buf(%rip), %rdx");
+      assembly += instrStr("movzbl\t(%rdx,%rcx), %eax");
+      assembly += instrStr("inc\t%rcx");
+      assembly += instrStr("mov\t%rcx, bf_in_pos(%rip)");
+      assembly += instrStr("jmp\t2f");
+      assembly += "1:\n";
+      // an interactive program's prompt has to be out before it waits for input
+      if(settings.lineBuffered)
+        assembly += instrStr("call\tbf_flush_output");
+      assembly += instrStr("call\tbf_read_refill");
+      if(settings.eof == EofBehavior::Unchanged) {
+        assembly += instrStr("test\t%eax, %eax");
+        assembly += instrStr("js\t3f");
       }
-      canBeSimpleLoop = false;
+      assembly += "2:\n";
+      assembly += instrStr("movb\t%al, "+offsetStr+"(%rbx)");
+      assembly += "3:\n";
+      return assembly;
+    }
+    case JumpIfZero: {
+      string assembly;
+      assembly += loopLabel(instr.loopId, JumpIfZero) + ":\n";
+      assembly += instrStr("cmpb\t$0, "+offsetStr+"(%rbx)");
+      assembly += instrStr("je\t"+loopLabel(instr.loopId, JumpUnlessZero));
+      return assembly;
+    }
+    case JumpUnlessZero: {
+      string assembly;
+      assembly += loopLabel(instr.loopId, JumpUnlessZero) + ":\n";
+      assembly += instrStr("cmpb\t$0, "+offsetStr+"(%rbx)");
+      assembly += instrStr("jne\t"+loopLabel(instr.loopId, JumpIfZero));
+      return assembly;
+    }
+    case EndOfFile:
+      return instrStr("ret");
+    case Zero:
+      return instrStr("movb\t$0, "+offsetStr+"(%rbx)");
+    case Sum:
+      return instrStr("addb\t$"+to_string(instr.amount)+", "+offsetStr+"(%rbx)");
+    case MulAdd: {
+      const string srcOffsetStr = (instr.srcOffset == 0) ? "" : to_string(instr.srcOffset);
+      const auto factor = static_cast<uint8_t>(instr.posInc ? -instr.amount : instr.amount);
+
+      // adding the source times -factor is subtracting it times factor, so take the cheaper
+      // one, where an imul's latency costs more than two shifts or leas
+      const vector<string> addSequence = multiplyAsm(factor);
+      const vector<string> subSequence = multiplyAsm(static_cast<uint8_t>(-factor));
+      const auto cost = [](const vector<string>& sequence) {
+        return (sequence.size() == 1 && sequence[0].rfind("imul", 0) == 0) ? 3 : sequence.size();
+      };
+      const bool subtract = cost(subSequence) < cost(addSequence);
+
+      string assembly;
+      assembly += instrStr("movzbl\t"+srcOffsetStr+"(%rbx), %eax");
+      for(const string& multiply : subtract ? subSequence : addSequence)
+        assembly += instrStr(multiply);
+      assembly += instrStr(string(subtract ? "subb" : "addb")+"\t%al, "+offsetStr+"(%rbx)");
+      return assembly;
+    }
+    case AddMemPtr:
+      return instrStr("add\t$"+to_string(instr.amount)+", %rbx");
+    case MemScan: {
+      // the scan routines move the tape pointer in place
+      string assembly;
+      if(instr.offset != 0)
+        assembly += instrStr("add\t$"+offsetStr+", %rbx");
+      assembly += instrStr("mov\t$"+to_string(abs(instr.amount))+", %esi");
+      assembly += instrStr(string("call\t*") + ((instr.amount < 0) ? "bf_scan_bwd" : "bf_scan_fwd") + "(%rip)");
+      if(instr.offset != 0)
+        assembly += instrStr("sub\t$"+offsetStr+", %rbx");
+      return assembly;
     }
+    case Print: {
+      string assembly;
+      assembly += instrStr("lea\t"+outputLabel(instr.stringId)+"(%rip), %rsi");
+      assembly += instrStr("mov\t$"+to_string(instr.amount)+", %edx");
+      assembly += instrStr("call\tbf_print");
+      if(settings.lineBuffered)
+        assembly += instrStr("call\tbf_flush_output");
+      return assembly;
+    }
+    default:
+      throw invalid_argument("Unsupported op type in assembly generation: " + to_string(static_cast<int>(instr.op)));
   }
-  
-  return std::move(instrs);
 }
 
-vector<unique_ptr<Instr>> instCombine(vector<unique_ptr<Instr>>& instrs, const MySettings& settings) {
-  if(!settings.runInstCombine)
-    return std::move(instrs);
-
-  int currMemOffset = 0;
-  unordered_map<int64_t, int64_t> incrementAtOffset;
-
-  size_t lhs = 0;
-  for(size_t rhs = 0; rhs < instrs.size(); ++rhs) {
-    const Op op = instrs.at(rhs)->op;
-    if(op == MoveRight)
-      ++currMemOffset;
-    else if(op == MoveLeft)
-      --currMemOffset;
-    else if(op == Inc)
-      ++incrementAtOffset[currMemOffset];
-    else if(op == Dec) 
-      --incrementAtOffset[currMemOffset];
-    else if(rhs < lhs + 2) { // >[>.
-      lhs = rhs + 1;
-      incrementAtOffset.clear();
-      currMemOffset = 0;
-    }
-    else{
-      vector<unique_ptr<Instr>> newInstrs;
-      for(const auto& [offset, amount] : incrementAtOffset) {
-        newInstrs.push_back(make_unique<SumInstr>(amount, offset));
-      }
-
-      if(currMemOffset != 0)
-        newInstrs.push_back(make_unique<AddMemPointerInstr>(currMemOffset));
-
-      long lhsIterOffset = static_cast<long>(lhs);
-      long rhsIterOffset = static_cast<long>(rhs);
-
-      instrs.erase(instrs.begin() + lhsIterOffset, instrs.begin() + rhsIterOffset);
-      instrs.insert(instrs.begin() + lhsIterOffset, make_move_iterator(newInstrs.begin()), make_move_iterator(newInstrs.end()));
+string compile(const vector<Instr>& instrs, const vector<string>& outputs, const MySettings& settings) {
+  const bool usesMemScan = any_of(instrs.begin(), instrs.end(), [](const Instr& instr){return instr.op == MemScan;});
+  const bool usesTape = any_of(instrs.begin(), instrs.end(), [](const Instr& instr){return instr.op != Print && instr.op != EndOfFile;});
+  const bool usesRead = any_of(instrs.begin(), instrs.end(), [](const Instr& instr){return instr.op == Read;});
+  string assembly = initializeProgram(usesMemScan, usesTape, usesRead, settings.eof);
+  for(const auto& instr : instrs) {
+    assembly += instrAsm(instr, settings);
+  }
+  return assembly + outputsAsm(outputs);
+}
 
-      lhs = static_cast<size_t>(lhsIterOffset + (newInstrs.end() - newInstrs.begin())) + 1;
-      rhs = lhs - 1;
-      incrementAtOffset.clear();
-      currMemOffset = 0;    
+// Block-buffered stdin for the JIT's Read, which ends input like compiled programs do
+struct JitInput {
+  array<unsigned char, INPUT_BUFFER_SIZE> buffer;
+  size_t position {0};
+  size_t end {0};
+  EofBehavior eof {EofBehavior::MinusOne};
+};
+static JitInput jitInput;
+
+void jitRead(unsigned char* const cell) {
+  if(jitInput.position == jitInput.end) {
+    // stdio no longer flushes a prompt written with putchar when we wait for input
+    fflush(stdout);
+    const ssize_t bytesRead = read(STDIN_FILENO, jitInput.buffer.data(), jitInput.buffer.size());
+    if(bytesRead <= 0) {
+      if(jitInput.eof != EofBehavior::Unchanged)
+        *cell = (jitInput.eof == EofBehavior::Zero) ? 0 : 255;
+      return;
     }
+    jitInput.position = 0;
+    jitInput.end = static_cast<size_t>(bytesRead);
   }
+  *cell = jitInput.buffer[jitInput.position++];
+}
 
-  return std::move(instrs);
+void jitPrint(const char* const data, const size_t length) {
+  fwrite(data, 1, length, stdout);
 }
 
-unordered_map<size_t, size_t> initializeLoopBracketIndexes(vector<unique_ptr<Instr>>& instrs) {
-  unordered_map<size_t, size_t> matchingIndex;
-  unordered_map<string, size_t> indexOfLabel;
+// The JIT's tape, which memory scans stop at the ends of
+struct JitTape {
+  unsigned char* begin {nullptr};
+  unsigned char* end {nullptr};
+};
+static JitTape jitTape;
 
-  for(size_t i = 0; i < instrs.size(); ++i) {
-    const auto& instr = instrs.at(i);
-    if(const JumpInstr *const jump = dynamic_cast<JumpInstr*>(instr.get())) {
-      const auto& [thisLabel, targetLabel] = jump->getLabels();
+[[noreturn]] void jitError(const string& message) {
+  fflush(stdout);
+  cerr << message;
+  exit(-1);
+}
 
-      if(indexOfLabel.find(targetLabel) == indexOfLabel.end()) {
-        indexOfLabel[thisLabel] = i;
-      }
-      else {
-        const auto indexOfTarget = indexOfLabel[targetLabel];
-        matchingIndex[i] = indexOfTarget;
-        matchingIndex[indexOfTarget] = i;
-      }
-    }
+// Returns the first zero cell at or past cell in steps of stride, like the compiled scan routines
+unsigned char* jitMemScan(unsigned char* const cell, const int64_t stride) {
+  const ptrdiff_t index = cell - jitTape.begin;
+  const ptrdiff_t size = jitTape.end - jitTape.begin;
+
+  if(stride == 1) {
+    void* const found = (index < size) ? memchr(cell, 0, static_cast<size_t>(size - index)) : nullptr;
+    if(!found)
+      jitError(tapeOverflowMsg);
+    return static_cast<unsigned char*>(found);
+  }
+  if(stride == -1) {
+    void* const found = (index >= 0) ? memrchr(jitTape.begin, 0, static_cast<size_t>(index + 1)) : nullptr;
+    if(!found)
+      jitError(tapeUnderflowMsg);
+    return static_cast<unsigned char*>(found);
   }
 
-  return matchingIndex;
+  for(ptrdiff_t i = index; ; i += stride) {
+    if(i >= size)
+      jitError(tapeOverflowMsg);
+    if(i < 0)
+      jitError(tapeUnderflowMsg);
+    if(jitTape.begin[i] == 0)
+      return jitTape.begin + i;
+  }
 }
 
-bool loopContainsRead(const vector<unique_ptr<Instr>>& instrs, const size_t start) {
-  int lhsSeen = 0;
-  for(size_t i = start; i < instrs.size(); ++i) {
-    if(instrs.at(i)->op == Read)
-      return true;
-    else if(instrs.at(i)->op == JumpUnlessZero) {
-      if(--lhsSeen == 0)
-        break;
+/**
+ * @brief Emits a call to a host function with the arguments set up by setupArgs, keeping
+ *        the tape pointer in rdi and the block index pointer in rsi. Generated code is
+ *        entered with rsp 8 past a multiple of 16, so the call is aligned with a third slot.
+ */
+void emitHostCall(X86Emitter& emitter, const void* const funcPtr, const function<void(X86Emitter&)>& setupArgs) {
+  emitter.push(RDI);
+  emitter.push(RSI);
+  emitter.sub(RSP, 8);
+  setupArgs(emitter);
+  emitter.movImm64(RAX, reinterpret_cast<uint64_t>(funcPtr));
+  emitter.call(RAX);
+  emitter.add(RSP, 8);
+  emitter.pop(RSI);
+  emitter.pop(RDI);
+}
+
+/**
+ * @brief Emits an instruction in the body of a basic block. Host functions are called
+ *        through their absolute address, since our binary and libc may be out of rel32
+ *        range of the code buffer.
+ */
+void emitInstr(X86Emitter& emitter, const Instr& instr, const vector<string>& outputs) {
+  const auto offset = static_cast<int32_t>(instr.offset);
+
+  switch(instr.op) {
+    case MoveRight:
+      emitter.inc(RDI);
+      break;
+    case MoveLeft:
+      emitter.dec(RDI);
+      break;
+    case Inc:
+      emitter.incByte(RDI, 0);
+      break;
+    case Dec:
+      emitter.decByte(RDI, 0);
+      break;
+    case Sum:
+      emitter.addByte(RDI, offset, static_cast<uint8_t>(instr.amount));
+      break;
+    case AddMemPtr:
+      emitter.add(RDI, static_cast<int32_t>(instr.amount));
+      break;
+    case Zero:
+      emitter.movByte(RDI, offset, 0);
+      break;
+    case MulAdd: {
+      const auto factor = static_cast<uint8_t>(instr.posInc ? -instr.amount : instr.amount);
+      emitter.movzxByte(RAX, RDI, static_cast<int32_t>(instr.srcOffset));
+      emitter.imul(RAX, RAX, factor);
+      emitter.addByte(RDI, offset, RAX);
+      break;
+    }
+    case Write:
+      emitHostCall(emitter, reinterpret_cast<void*>(putchar), [offset](X86Emitter& e){ e.movzxByte(RDI, RDI, offset); });
+      break;
+    case Read:
+      // jitRead stores the byte itself
+      emitHostCall(emitter, reinterpret_cast<void*>(jitRead), [offset](X86Emitter& e){ e.lea(RDI, RDI, offset); });
+      break;
+    case Print: {
+      const string& output = outputs[instr.stringId];
+      emitHostCall(emitter, reinterpret_cast<void*>(jitPrint), [&output, &instr](X86Emitter& e) {
+        e.movImm64(RDI, reinterpret_cast<uint64_t>(output.data()));
+        e.movImm32(RSI, static_cast<int32_t>(instr.amount));
+      });
+      break;
     }
-    else if(instrs.at(i)->op == JumpIfZero)
-      ++lhsSeen;
+    case MemScan:
+      // the one push keeps the call aligned, and rdi comes back from jitMemScan
+      emitter.push(RSI);
+      emitter.lea(RDI, RDI, offset);
+      emitter.movImm32(RSI, static_cast<int32_t>(instr.amount));
+      emitter.movImm64(RAX, reinterpret_cast<uint64_t>(jitMemScan));
+      emitter.call(RAX);
+      emitter.lea(RDI, RAX, -offset);
+      emitter.pop(RSI);
+      break;
+    default:
+      throw invalid_argument("This instruction can not assemble currently");
   }
-  return false;
 }
 
-vector<unique_ptr<Instr>> partialEval(vector<unique_ptr<Instr>>& instrs, const MySettings& settings) {
-  if(!settings.partialEval)
-    return std::move(instrs);
-
-  unordered_map<int64_t, unsigned char> valAtOffset;
-  unordered_set<size_t> loopDoesntContainRead;
-  int64_t offset = 0;
-  int64_t curPartialEvalOffset = 0;
-  vector<unique_ptr<Instr>> newInstrs;
-  unordered_set<int64_t> offsetsThatPrintedNonzero;
-
-  const unordered_map<size_t, size_t> matchingLoopBracket = initializeLoopBracketIndexes(instrs);
-  const size_t instrSize = instrs.size();
-  for(size_t IP = 0; IP < instrSize; ++IP) {
-    const auto& instr = instrs[IP];
-
-    switch(instr->op) {
-      case MoveRight:
-        ++offset;
-        break;
-      case MoveLeft:
-        --offset;
-        break;
-      case Inc:
-        if(++valAtOffset[offset] == 0)
-          valAtOffset.erase(offset);
-        break;
-      case Dec:
-        if(--valAtOffset[offset] == 0)
-          valAtOffset.erase(offset);
-        break;
-      case Write:
-        newInstrs.push_back(make_unique<AddMemPointerInstr>(offset - curPartialEvalOffset));
-        newInstrs.push_back(make_unique<ZeroInstr>());
-        newInstrs.push_back(make_unique<SumInstr>(valAtOffset[offset], 0));
-        if(valAtOffset[offset] == 0) {
-          valAtOffset.erase(offset);
-          if(offsetsThatPrintedNonzero.count(offset))
-            offsetsThatPrintedNonzero.erase(offset);
-        }
-        else
-          offsetsThatPrintedNonzero.insert(offset);
-
-        newInstrs.push_back(make_unique<WriteInstr>());
-        curPartialEvalOffset = offset;
-        break;
-      case Read:
-        for(const auto [memOffset, val] : valAtOffset) {
-          newInstrs.push_back(make_unique<AddMemPointerInstr>(memOffset - curPartialEvalOffset));
-          newInstrs.push_back(make_unique<ZeroInstr>());
-          newInstrs.push_back(make_unique<SumInstr>(val, 0));
-          curPartialEvalOffset = memOffset;
-        }
+// Bytes kept for the terminator of a basic block, so it can be patched in place
+constexpr size_t JIT_TERMINATOR_SIZE = 32;
+// Bytes kept for any other instruction, the longest of which (Print) takes 41
+constexpr size_t JIT_MAX_INSTR_SIZE = 48;
+// Bytes kept for a [ or ] when the whole program is compiled at once, a compare and a jump
+constexpr size_t JIT_BRANCH_SIZE = 16;
+// Size of the first code cache segment, each next one is twice as large
+constexpr size_t JIT_FIRST_SEGMENT_SIZE = 1 << 16;
 
-        for(const int64_t offsetThatMustZero : offsetsThatPrintedNonzero) {
-          if(valAtOffset.find(offsetThatMustZero) != valAtOffset.end())
-            continue;
-          newInstrs.push_back(make_unique<AddMemPointerInstr>(offsetThatMustZero - curPartialEvalOffset));
-          newInstrs.push_back(make_unique<ZeroInstr>());
-          curPartialEvalOffset = offsetThatMustZero;
-        }
-        offsetsThatPrintedNonzero.clear();
-
-        newInstrs.push_back(make_unique<AddMemPointerInstr>(offset - curPartialEvalOffset));
+/**
+ * @brief Emits the [, ] or end of file that ends a basic block. Branch targets that are
+ *        not generated yet go to the exit, which returns to the JIT loop with the block
+ *        index and tape pointer. The rest of the JIT_TERMINATOR_SIZE bytes are padding.
+ */
+void emitTerminator(X86Emitter& emitter, const Instr& instr, const size_t bbNum,
+                    const unsigned char* const jumpOnZeroTarget, const unsigned char* const jumpNotZeroTarget) {
+  unsigned char* const start = emitter.position();
+  X86Emitter::Label exit;
+
+  if(instr.op != EndOfFile) {
+    emitter.cmpByte(RDI, static_cast<int32_t>(instr.offset), 0);
+    if(jumpOnZeroTarget)
+      emitter.jcc(Equal, jumpOnZeroTarget);
+    else
+      emitter.jcc(Equal, exit);
+    if(jumpNotZeroTarget)
+      emitter.jmp(jumpNotZeroTarget);
+    else
+      emitter.jmp(exit);
+  }
 
-        instrs.erase(instrs.begin(), instrs.begin() + static_cast<long>(IP));
-        instrs.insert(instrs.begin(), make_move_iterator(newInstrs.begin()), make_move_iterator(newInstrs.end()));
-        IP = instrSize;
-        break;
-      case JumpIfZero:
-        if(loopDoesntContainRead.find(IP) == loopDoesntContainRead.end()) {
-          if(loopContainsRead(instrs, IP)) {
-            for(const auto [memOffset, val] : valAtOffset) {
-              newInstrs.push_back(make_unique<AddMemPointerInstr>(memOffset - curPartialEvalOffset));
-              newInstrs.push_back(make_unique<ZeroInstr>());
-              newInstrs.push_back(make_unique<SumInstr>(val, 0));
-              curPartialEvalOffset = memOffset;
-            }
-
-            for(const int64_t offsetThatMustZero : offsetsThatPrintedNonzero) {
-              if(valAtOffset.find(offsetThatMustZero) != valAtOffset.end())
-                continue;
-              newInstrs.push_back(make_unique<AddMemPointerInstr>(offsetThatMustZero - curPartialEvalOffset));
-              newInstrs.push_back(make_unique<ZeroInstr>());
-              curPartialEvalOffset = offsetThatMustZero;
-            }
-            offsetsThatPrintedNonzero.clear();
-
-            newInstrs.push_back(make_unique<AddMemPointerInstr>(offset - curPartialEvalOffset));
-
-            instrs.erase(instrs.begin(), instrs.begin() + static_cast<long>(IP));
-            instrs.insert(instrs.begin(), make_move_iterator(newInstrs.begin()), make_move_iterator(newInstrs.end()));
-            IP = instrSize;
-            break;
-          }
-          loopDoesntContainRead.insert(IP);
-        }
+  emitter.bind(exit);
+  emitter.movDword(RSI, 0, static_cast<uint32_t>(bbNum));
+  emitter.mov(RAX, RDI);
+  emitter.ret();
 
-        if(valAtOffset.find(offset) == valAtOffset.end())
-          IP = matchingLoopBracket.at(IP) - 1;
-        break;
-      case JumpUnlessZero:
-        if(valAtOffset.find(offset) != valAtOffset.end())
-          IP = matchingLoopBracket.at(IP) - 1;
-        break;
-      case EndOfFile:
-        instrs.erase(instrs.begin(), instrs.begin() + static_cast<long>(IP));
-        instrs.insert(instrs.begin(), make_move_iterator(newInstrs.begin()), make_move_iterator(newInstrs.end()));
-        IP = instrSize;
-        break;
-      case Zero:
-        valAtOffset.erase(offset);
-        break;
-      case Sum: {
-        const auto& [amount, furtherOffset] = dynamic_cast<SumInstr*>(instr.get())->amountAndOffset();
-        valAtOffset[offset + furtherOffset] += amount;
+  const auto used = static_cast<size_t>(emitter.position() - start);
+  if(used > JIT_TERMINATOR_SIZE)
+    throw logic_error("Basic block terminator does not fit its reserved space");
+  emitter.nops(JIT_TERMINATOR_SIZE - used);
+}
 
-        if(valAtOffset[offset + furtherOffset] == 0)
-          valAtOffset.erase(offset + furtherOffset);
-        break;
-      }
-      case MulAdd: {
-        const auto& [amount, furtherOffset, posInc] = dynamic_cast<MulAddInstr*>(instr.get())->amountOffsetPosInc();
-        unsigned char repeatAmount = valAtOffset[offset];
-        if(valAtOffset[offset] == 0)
-          valAtOffset.erase(offset);
 
-        if(posInc)
-          repeatAmount = ~repeatAmount + 1;
+/**
+ * @brief Executable memory for the JIT, which is writable or executable but never both.
+ *        The whole capacity is reserved up front without access, so every jump between
+ *        blocks stays in rel32 range, and a chain of segments is committed from it in
+ *        order, each twice the size of the one before. Writes make only the pages they
+ *        touch writable, and seal() makes those executable again before generated code
+ *        runs. Once the capacity is used up, the cache can only be flushed whole.
+ */
+class JitCodeCache {
+public:
+  explicit JitCodeCache(const size_t requestedCapacity) {
+    pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    capacity = roundUpToPage(requestedCapacity);
+    if(capacity == 0 || capacity > INT32_MAX)
+      jitError("The JIT code cache size must be between 1 byte and 2 GiB\n");
 
-        unsigned char mulResult = repeatAmount * amount;
-        valAtOffset[offset + furtherOffset] += mulResult;
+    void* const reserved = mmap(nullptr, capacity, PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if(reserved == MAP_FAILED)
+      jitError("Unable to reserve the JIT code cache: " + string(strerror(errno)) + "\n");
+    base = static_cast<unsigned char*>(reserved);
+  }
 
-        if(valAtOffset[offset + furtherOffset] == 0)
-          valAtOffset.erase(offset + furtherOffset);
-        break;
-      }
-      case AddMemPtr: {
-        const auto amount = dynamic_cast<AddMemPointerInstr*>(instr.get())->getAmount();
+  JitCodeCache(const JitCodeCache&) = delete;
+  JitCodeCache& operator=(const JitCodeCache&) = delete;
 
-        offset += amount;
-        break;
-      }
-      case MemScan: {
-        const auto stride = dynamic_cast<MemScanInstr*>(instr.get())->getStride();
+  ~JitCodeCache() {
+    munmap(base, capacity);
+  }
 
-        offset += stride;
-        break;
-      }
-      default:
-        throw invalid_argument("Unsupported op type in partial evaluator: " + to_string(instr->op));
-        break;      
+  /**
+   * @brief Returns maxSize writable bytes for a basic block, in the last segment or a new
+   *        one, or nullptr when the cache is full. trimAllocation gives back the rest.
+   */
+  unsigned char* allocate(const size_t maxSize) {
+    if(segments.empty() || static_cast<size_t>(segmentEnd(segments.back()) - cursor) < maxSize) {
+      const size_t committed = segments.empty() ? 0 : static_cast<size_t>(segmentEnd(segments.back()) - base);
+      size_t size = segments.empty() ? JIT_FIRST_SEGMENT_SIZE : 2 * segments.back().size;
+      size = min(max(size, roundUpToPage(maxSize)), capacity - committed);
+      if(size < maxSize)
+        return nullptr;
+
+      segments.push_back({base + committed, size});
+      protect(segments.back().begin, size, PROT_READ | PROT_EXEC);
+      cursor = segments.back().begin;
     }
+
+    unsigned char* const memory = cursor;
+    cursor += maxSize;
+    makeWritable(memory, maxSize);
+    return memory;
   }
 
-  return std::move(instrs);
-}
+  void trimAllocation(unsigned char* const end) {
+    cursor = end;
+  }
 
+  void makeWritable(unsigned char* const address, const size_t size) {
+    unsigned char* const begin = base + (static_cast<size_t>(address - base) / pageSize) * pageSize;
+    unsigned char* const end = base + roundUpToPage(static_cast<size_t>(address + size - base));
+    if(!writable.empty() && writable.back().first <= begin && end <= writable.back().second)
+      return;
 
-vector<unique_ptr<Instr>> optimize(vector<unique_ptr<Instr>>& instrs, const MySettings& settings) {
-  auto simplifiedLoops = simplifyLoops(instrs, settings);
-  auto instCombinedInstrs = instCombine(simplifiedLoops, settings);
-  return partialEval(instCombinedInstrs, settings);
-}
+    protect(begin, static_cast<size_t>(end - begin), PROT_READ | PROT_WRITE);
+    writable.emplace_back(begin, end);
+  }
 
-string compile(const vector<unique_ptr<Instr>>& instrs) {
-  string assembly = initializeProgram();
-  for(const auto& instr : instrs) {
-    assembly += instr->str();
+  void seal() {
+    for(const auto& [begin, end] : writable)
+      protect(begin, static_cast<size_t>(end - begin), PROT_READ | PROT_EXEC);
+    writable.clear();
   }
-  return assembly;
-}
 
-bool checkValidInstrs(const vector<Op>& ops) {
-  stack<Op> lhsBrackets;
+  // Drops all generated code, which must not be running or jumped to again
+  void flush() {
+    if(segments.empty())
+      return;
+    const auto committed = static_cast<size_t>(segmentEnd(segments.back()) - base);
+    protect(base, committed, PROT_NONE);
+    madvise(base, committed, MADV_DONTNEED);
+    segments.clear();
+    writable.clear();
+  }
 
-  for(const auto op : ops) {
-    if(op == JumpIfZero)
-      lhsBrackets.push(op);
-    else if(op == JumpUnlessZero) {
-      if(lhsBrackets.empty())
-        return false;
+private:
+  struct Segment {
+    unsigned char* begin;
+    size_t size;
+  };
 
-      lhsBrackets.pop();
-    }
+  static unsigned char* segmentEnd(const Segment& segment) {
+    return segment.begin + segment.size;
   }
 
-  return true;
-}
+  size_t roundUpToPage(const size_t size) const {
+    return (size + pageSize - 1) / pageSize * pageSize;
+  }
 
+  static void protect(unsigned char* const begin, const size_t size, const int protection) {
+    if(mprotect(begin, size, protection) != 0)
+      jitError("Unable to change the protection of the JIT code cache: " + string(strerror(errno)) + "\n");
+  }
 
+  unsigned char* base {nullptr};
+  size_t capacity {0};
+  size_t pageSize {0};
+  vector<Segment> segments;
+  unsigned char* cursor {nullptr};
+  // page ranges made writable since the last seal
+  vector<pair<unsigned char*, unsigned char*>> writable;
+};
 
 struct BasicBlock {
-  BasicBlock(vector<unique_ptr<Instr>>& inputInstrs, size_t startIndex, size_t endIndex, size_t bbIndex) 
-            : bbIndex(bbIndex), startIndex(startIndex), endIndex(endIndex) {
-    long startLongCast = static_cast<long>(startIndex);
-    long endLongCast = static_cast<long>(endIndex);
-
-    instrs.insert(instrs.begin(), make_move_iterator(inputInstrs.begin() + startLongCast), make_move_iterator(inputInstrs.begin() + endLongCast));
-  }
+  BasicBlock(const vector<Instr>& inputInstrs, size_t start, size_t end, size_t index) 
+            : terminator(inputInstrs[end - 1]), bbIndex(index), startIndex(start), endIndex(end) {}
   /**
   * @brief Generates the encoded instructions in memory starting at blockStartMemory, 
   *        and returns a pointer to the next valid position to insert memory.
@@ -1246,81 +1054,38 @@ struct BasicBlock {
   * @param blockStartMemory 
   * @return unsigned* 
   */
-  unsigned char* generateBasicBlockInstrs(unsigned char* const blockStartMemory) {
-    unsigned char* currMemPos = blockStartMemory;
-
-    for(size_t i = 0; i < instrs.size(); ++i) {
-      const auto& instr = instrs[i];
-
-      switch(instr->op) {
-        case Write: {
-          const WriteInstr *const writeInstr = dynamic_cast<WriteInstr*>(instr.get());
-          const string objcode = writeInstr->assemble(currMemPos);
-          memcpy(currMemPos, objcode.c_str(), objcode.size());
-          instrToMemAddr.push_back(currMemPos);
-          currMemPos += objcode.size();
-          break;
-        }
-        case Read: {
-          const ReadInstr *const readInstr = dynamic_cast<ReadInstr*>(instr.get());
-          const string objcode = readInstr->assemble(currMemPos);
-          memcpy(currMemPos, objcode.c_str(), objcode.size());
-          instrToMemAddr.push_back(currMemPos);
-          currMemPos += objcode.size();
-          break;
-        }
-        case JumpIfZero: 
-        case JumpUnlessZero: 
-        case EndOfFile: {
-          if(EndOfFileInstr* eofInstr = dynamic_cast<EndOfFileInstr*>(instr.get())) {
-            eofInstr->setBBNum(bbIndex);
-          }
-          else {
-            JumpInstr* jumpInstr = dynamic_cast<JumpInstr*>(instr.get());
-            jumpInstr->setInstrStartAddr(currMemPos);
-            jumpInstr->setBBNum(bbIndex);
-          }
-          // implicit fallthrough
-        }
-        default: {
-          const string objcode = instr->assemble();
-          memcpy(currMemPos, objcode.c_str(), objcode.size());
-          instrToMemAddr.push_back(currMemPos);
-          currMemPos += objcode.size();
-          break;
-        }
-      }
-    }
+  unsigned char* generateBasicBlockInstrs(unsigned char* const blockStartMemory, const vector<Instr>& instrs,
+                                          const vector<string>& outputs) {
+    X86Emitter emitter(blockStartMemory);
+    for(size_t i = startIndex; i + 1 < endIndex; ++i)
+      emitInstr(emitter, instrs[i], outputs);
 
-    return currMemPos;
+    firstInstrMemAddr = blockStartMemory;
+    finalInstrMemAddr = emitter.position();
+    emitTerminator(emitter, terminator, bbIndex, nullptr, nullptr);
+    return emitter.position();
   }
 
   void setTailOnZeroMemAddr(unsigned char* const nextMemAddr) {
-    auto jumpInstr = dynamic_cast<JumpInstr*>(instrs.back().get());
-    jumpInstr->setZeroTarget(nextMemAddr);
-
-    const string objcode = jumpInstr->assemble();
-    memcpy(instrToMemAddr.back(), objcode.c_str(), objcode.size());
+    jumpOnZeroTarget = nextMemAddr;
+    patchTail();
   }
 
   void setTailOnNotZeroMemAddr(unsigned char* const nextMemAddr) {
-    auto jumpInstr = dynamic_cast<JumpInstr*>(instrs.back().get());
-    jumpInstr->setNotZeroTarget(nextMemAddr);
-
-    const string objcode = jumpInstr->assemble();
-    memcpy(instrToMemAddr.back(), objcode.c_str(), objcode.size());
+    jumpNotZeroTarget = nextMemAddr;
+    patchTail();
   }
 
   unsigned char* getFinalInstrMemAddr() {
-    return instrToMemAddr.back();
+    return finalInstrMemAddr;
   }
 
   Op getFinalInstrOp() {
-    return instrs.back()->op;
+    return terminator.op;
   }
 
   unsigned char* getFirstInstrMemAddr() {
-    return instrToMemAddr.front();
+    return firstInstrMemAddr;
   }
 
   size_t getEndIndex() {
@@ -1328,131 +1093,353 @@ struct BasicBlock {
   }
 
 private:
-  vector<unique_ptr<Instr>> instrs;
-  vector<unsigned char*> instrToMemAddr;
+  void patchTail() {
+    X86Emitter emitter(finalInstrMemAddr);
+    emitTerminator(emitter, terminator, bbIndex, jumpOnZeroTarget, jumpNotZeroTarget);
+  }
+
+  Instr terminator;
   size_t bbIndex, startIndex, endIndex;
+  unsigned char* firstInstrMemAddr = nullptr;
+  unsigned char* finalInstrMemAddr = nullptr;
+  unsigned char* jumpOnZeroTarget = nullptr;
+  unsigned char* jumpNotZeroTarget = nullptr;
 };
 
-void executeJIT(vector<unique_ptr<Instr>>& instrs) {
-  // give enough space for 32 * instrs bytes, should
-  // be able to hold an arbitrary amount of instructions
-  unsigned int power = 1;
-  while(power < 32 * instrs.size())
-      power <<= 1;
-  const size_t memorySize = power;
-  auto* execMemVoidPtr = mmap(nullptr, memorySize, 
-                          PROT_READ | PROT_WRITE | PROT_EXEC,
-                          MAP_ANON | MAP_PRIVATE, 
-                          -1, 0);
-
-  auto *execMemPtr = static_cast<unsigned char*>(execMemVoidPtr);
+/**
+ * @brief Generates basic blocks as execution first reaches them. A new block's branches are
+ *        linked to the blocks that exist, and branches waiting for it are linked once it is
+ *        generated, so generated code only returns to run() to generate more.
+ */
+class BlockJit {
+public:
+  BlockJit(const vector<Instr>& program, const vector<string>& programOutputs, const size_t codeCacheSize)
+          : instrs(program), outputs(programOutputs), codeCache(codeCacheSize),
+            matchingLoopBracket(initializeLoopBracketIndexes(program)) {}
+
+  /**
+   * @brief Runs generated code from the instruction at instrIndex, generating its block first
+   *        if needed, and moves tapePtr along. Returns the instruction to go on at, which is
+   *        past the end of the program once it is done.
+   */
+  size_t run(const size_t instrIndex, unsigned char*& tapePtr) {
+    auto bb = startInstrIndexToBB.find(instrIndex);
+    if(bb == startInstrIndexToBB.end())
+      bb = generateBasicBlock(instrIndex);
+    codeCache.seal();
+
+    // updates lastBBIndex, and returns the tape pointer
+    typedef unsigned char* (*fptr)(unsigned char* currTapePtr, unsigned* finalBBIndex);
+    unsigned lastBBIndex;
+    tapePtr = reinterpret_cast<fptr>(basicBlocks[bb->second].getFirstInstrMemAddr())(tapePtr, &lastBBIndex);
+
+    const size_t branchInstrIndex = basicBlocks[lastBBIndex].getEndIndex() - 1;
+    const Instr& branch = instrs[branchInstrIndex];
+    if(branch.op == EndOfFile)
+      return instrs.size();
+    return branchTarget(branchInstrIndex, tapePtr[branch.offset] == 0);
+  }
+
+private:
+  // [ jumps past its ] on zero, and ] jumps back into the loop body otherwise
+  size_t branchTarget(const size_t branchInstrIndex, const bool onZero) const {
+    const bool jumps = (instrs[branchInstrIndex].op == JumpIfZero) == onZero;
+    return jumps ? matchingLoopBracket.at(branchInstrIndex) + 1 : branchInstrIndex + 1;
+  }
+
+  void linkBranch(const size_t bbIndex, const bool onZero, unsigned char* const target) {
+    BasicBlock& bb = basicBlocks[bbIndex];
+    codeCache.makeWritable(bb.getFinalInstrMemAddr(), JIT_TERMINATOR_SIZE);
+    if(onZero)
+      bb.setTailOnZeroMemAddr(target);
+    else
+      bb.setTailOnNotZeroMemAddr(target);
+  }
+
+  unordered_map<size_t, size_t>::iterator generateBasicBlock(const size_t startIndex) {
+    size_t endIndex = startIndex;
+    while(instrs[endIndex].op != JumpIfZero && instrs[endIndex].op != JumpUnlessZero && instrs[endIndex].op != EndOfFile)
+      ++endIndex;
+    ++endIndex;
+
+    const size_t maxSize = (endIndex - startIndex - 1) * JIT_MAX_INSTR_SIZE + JIT_TERMINATOR_SIZE;
+    unsigned char* memory = codeCache.allocate(maxSize);
+    if(!memory) {
+      // evict everything, and generate again what is still used
+      codeCache.flush();
+      basicBlocks.clear();
+      startInstrIndexToBB.clear();
+      unlinkedBranches.clear();
+      memory = codeCache.allocate(maxSize);
+      if(!memory)
+        jitError("A basic block of up to " + to_string(maxSize) + " bytes does not fit in the JIT code cache\n");
+    }
+
+    const size_t bbIndex = basicBlocks.size();
+    basicBlocks.emplace_back(instrs, startIndex, endIndex, bbIndex);
+    codeCache.trimAllocation(basicBlocks.back().generateBasicBlockInstrs(memory, instrs, outputs));
+    const auto bb = startInstrIndexToBB.emplace(startIndex, bbIndex).first;
+
+    // link the branches waiting for this block, and its own branches to blocks we already have
+    const auto waiting = unlinkedBranches.find(startIndex);
+    if(waiting != unlinkedBranches.end()) {
+      for(const auto& [waitingBBIndex, onZero] : waiting->second)
+        linkBranch(waitingBBIndex, onZero, memory);
+      unlinkedBranches.erase(waiting);
+    }
+    if(instrs[endIndex - 1].op != EndOfFile) {
+      for(const bool onZero : {true, false}) {
+        const size_t target = branchTarget(endIndex - 1, onZero);
+        const auto targetBB = startInstrIndexToBB.find(target);
+        if(targetBB != startInstrIndexToBB.end())
+          linkBranch(bbIndex, onZero, basicBlocks[targetBB->second].getFirstInstrMemAddr());
+        else
+          unlinkedBranches[target].emplace_back(bbIndex, onZero);
+      }
+    }
+
+    return bb;
+  }
+
+  const vector<Instr>& instrs;
+  const vector<string>& outputs;
+  JitCodeCache codeCache;
   vector<BasicBlock> basicBlocks;
 
   // map where to jump for [ and ]
-  const unordered_map<size_t, size_t> matchingLoopBracket = initializeLoopBracketIndexes(instrs);
-  unordered_map<size_t, size_t> jzInstrToBB;
+  const unordered_map<size_t, size_t> matchingLoopBracket;
   unordered_map<size_t, size_t> startInstrIndexToBB;
+  // branches of generated blocks to instructions with no block yet, which return to run() until it exists
+  unordered_map<size_t, vector<pair<size_t, bool>>> unlinkedBranches;
+};
 
+// Allocates the tape the JIT tiers share, and returns the pointer to its middle
+unsigned char* createJitTape() {
+  jitTape.begin = static_cast<unsigned char*>(calloc(TAPESIZE, 1));
+  jitTape.end = jitTape.begin + TAPESIZE;
+  return jitTape.begin + TAPESIZE / 2;
+}
 
-  // create tape
-  unsigned char *const tapePtr = static_cast<unsigned char*>(calloc(TAPESIZE, 1)) + TAPESIZE / 2;
-  unsigned char* currTapePtr = tapePtr;
-
-  // create function call to get to executable code
-  // updates finalBBIndex after every call
-  // returns final memory cell pointed to before exiting
-  typedef unsigned char* (*fptr)(unsigned char* currTapePtr, unsigned* finalBBIndex);
-  unsigned char* nextExecMemPtr = nullptr;
-  unsigned char* nextFreeMemory = execMemPtr;
-
-  for(size_t lhs = 0, rhs = 0; rhs < instrs.size(); ++rhs) {
-    const auto& instr = instrs[rhs];
-
-    if(!instr || instr->op == JumpIfZero || instr->op == JumpUnlessZero || instr->op == EndOfFile) {
-      // perhaps we ended up somewhere where we already generated this basic block, 
-      // so want to skip this block and just execute some code
-      if(instr) {
-        const Op op = instr->op;
-        const size_t nextBBIndex = basicBlocks.size();
-        basicBlocks.emplace_back(instrs, lhs, rhs + 1, nextBBIndex);
-        startInstrIndexToBB[lhs] = nextBBIndex;
-        nextFreeMemory = basicBlocks.back().generateBasicBlockInstrs(nextFreeMemory);
-
-        if(op == JumpIfZero)
-          jzInstrToBB[rhs] = nextBBIndex;
-
-        // if jumpUnlessZero, then we already can form the backedge to the jumpifzero instruction
-        if(op == JumpUnlessZero) {
-          auto targetLoopInstrIndex = matchingLoopBracket.at(rhs);
-          auto targetBBIndex = jzInstrToBB[targetLoopInstrIndex];
-          auto targetJumpAddr = basicBlocks[targetBBIndex].getFinalInstrMemAddr();
-          basicBlocks.back().setTailOnNotZeroMemAddr(targetJumpAddr);
-        }
-      }
+void executeJIT(const vector<Instr>& instrs, const vector<string>& outputs, const MySettings& settings) {
+  jitInput.eof = settings.eof;
+  unsigned char* tapePtr = createJitTape();
 
-      unsigned lastBBIndex;
+  BlockJit jit(instrs, outputs, settings.jitCodeCacheSize);
+  for(size_t instrIndex = 0; instrIndex < instrs.size(); )
+    instrIndex = jit.run(instrIndex, tapePtr);
+}
 
-      // for(intptr_t i = reinterpret_cast<intptr_t>(execMemPtr); i < reinterpret_cast<intptr_t>(nextExecMemPtr); ++i)
-      //   cerr << *reinterpret_cast<unsigned char *>(i);
-      // cerr << flush;
+/**
+ * @brief Compiles the whole program up front into one function, and runs it. The [ of a loop
+ *        jumps to a label after its ], which is fixed up once the ] is emitted, and the ]
+ *        jumps back to the top of the body directly, so the program never returns early.
+ */
+void executeEagerJIT(const vector<Instr>& instrs, const vector<string>& outputs, const MySettings& settings) {
+  jitInput.eof = settings.eof;
+  unsigned char* const tapePtr = createJitTape();
 
-      // create the function pointer to the executable memory we want to go to
-      fptr my_fptr = reinterpret_cast<fptr>(reinterpret_cast<long>(execMemPtr));
-      // jump to memory
-      currTapePtr = my_fptr(currTapePtr, &lastBBIndex);
+  size_t maxSize = 0;
+  for(const auto& instr : instrs) {
+    const bool isBranch = instr.op == JumpIfZero || instr.op == JumpUnlessZero || instr.op == EndOfFile;
+    maxSize += isBranch ? JIT_BRANCH_SIZE : JIT_MAX_INSTR_SIZE;
+  }
 
-      BasicBlock& lastBB = basicBlocks[lastBBIndex];
-      const Op finalInstrOp = lastBB.getFinalInstrOp();
-      const size_t brachInstIndex = lastBB.getEndIndex() - 1;
+  // nothing is evicted, so the cache only has to hold the program
+  JitCodeCache codeCache(maxSize);
+  unsigned char* const entry = codeCache.allocate(maxSize);
+  X86Emitter emitter(entry);
 
-      // see the next place to point to by default to new, free memory
-      nextExecMemPtr = nextFreeMemory;
+  // the top of the body and the end of each loop we are in
+  struct LoopLabels {
+    X86Emitter::Label body;
+    X86Emitter::Label end;
+  };
+  stack<LoopLabels> loops;
 
+  for(const auto& instr : instrs) {
+    switch(instr.op) {
+      case JumpIfZero:
+        loops.emplace();
+        emitter.cmpByte(RDI, instr.offset, 0);
+        emitter.jcc(Equal, loops.top().end);
+        emitter.bind(loops.top().body);
+        break;
+      case JumpUnlessZero:
+        emitter.cmpByte(RDI, instr.offset, 0);
+        emitter.jcc(NotEqual, loops.top().body);
+        emitter.bind(loops.top().end);
+        loops.pop();
+        break;
+      case EndOfFile:
+        emitter.mov(RAX, RDI);
+        emitter.ret();
+        break;
+      default:
+        emitInstr(emitter, instr, outputs);
+        break;
+    }
+  }
+  codeCache.seal();
 
-      if(finalInstrOp == JumpIfZero) {
-        if(*currTapePtr == 0) {
-          const size_t firstInstrIndex = matchingLoopBracket.at(brachInstIndex) + 1;
-          if(startInstrIndexToBB.find(firstInstrIndex) != startInstrIndexToBB.end()) {
-            size_t existinBBIndex = startInstrIndexToBB[firstInstrIndex];
-            nextExecMemPtr = basicBlocks.at(existinBBIndex).getFirstInstrMemAddr();
-          }
+  typedef unsigned char* (*fptr)(unsigned char* currTapePtr);
+  reinterpret_cast<fptr>(entry)(tapePtr);
+}
 
-          lastBB.setTailOnZeroMemAddr(nextExecMemPtr);
-          rhs = firstInstrIndex - 1;
-          lhs = firstInstrIndex;
-        }
-        else {
-          if(startInstrIndexToBB.find(brachInstIndex + 1) != startInstrIndexToBB.end()) {
-            size_t existinBBIndex = startInstrIndexToBB[brachInstIndex + 1];
-            nextExecMemPtr = basicBlocks.at(existinBBIndex).getFirstInstrMemAddr();
-          }
-          
-          lastBB.setTailOnNotZeroMemAddr(nextExecMemPtr);
-          rhs = brachInstIndex;
-          lhs = rhs + 1;
-        }
-      }
-      else if(finalInstrOp == JumpUnlessZero) {
-        if(startInstrIndexToBB.find(brachInstIndex + 1) != startInstrIndexToBB.end()) {
-          size_t existinBBIndex = startInstrIndexToBB[brachInstIndex + 1];
-          nextExecMemPtr = basicBlocks.at(existinBBIndex).getFirstInstrMemAddr();
-        }
-        lastBB.setTailOnZeroMemAddr(nextExecMemPtr);
-        rhs = brachInstIndex;
-        lhs = rhs + 1;
+/**
+ * @brief The first tier of --tiered, a threaded interpreter of the optimized IR, which shares
+ *        its tape and I/O with the JIT so either can go on where the other stopped. It counts
+ *        the back edges each loop takes, and once a loop takes threshold of them, marks its
+ *        body as hot, which is then run by the JIT from the top of the body onwards.
+ */
+class TierZeroInterpreter {
+public:
+  TierZeroInterpreter(const vector<Instr>& program, const vector<string>& programOutputs, const size_t tierUpThreshold)
+                     : instrs(program), outputs(programOutputs), matchingLoopBracket(program.size()),
+                       enclosingLoop(program.size(), NO_LOOP), backEdges(program.size()), hot(program.size()),
+                       threshold(tierUpThreshold) {
+    for(const auto& [lhs, rhs] : initializeLoopBracketIndexes(program))
+      matchingLoopBracket[lhs] = rhs;
+
+    stack<size_t> openLoops;
+    for(size_t i = 0; i < program.size(); ++i) {
+      if(program[i].op == JumpIfZero) {
+        if(!openLoops.empty())
+          enclosingLoop[i] = openLoops.top();
+        openLoops.push(matchingLoopBracket[i]);
       }
-      execMemPtr = nextExecMemPtr;
+      else if(program[i].op == JumpUnlessZero)
+        openLoops.pop();
     }
   }
 
-  // for(intptr_t i = reinterpret_cast<intptr_t>(execMemVoidPtr); i < reinterpret_cast<intptr_t>(execMemVoidPtr) + 256; ++i)
-  //   cerr << *reinterpret_cast<unsigned char *>(i);
-  // cerr << flush;
+  bool isHot(const size_t instrIndex) const {
+    return hot[instrIndex];
+  }
 
-  // cout << totalObjCode;
-  // cout << flush;
+  /**
+   * @brief Interprets from the instruction at instrIndex, moving tapePtr along, until it gets
+   *        to hot code. Returns the instruction it stopped at, which is past the end of the
+   *        program once it is done.
+   */
+  size_t run(const size_t instrIndex, unsigned char*& tapePtr) {
+    static const void* const handlers[] = {&&LabMoveRight, &&LabMoveLeft, &&LabInc, &&LabDec, &&LabWrite,
+                                           &&LabRead, &&LabJumpIfZero, &&LabJumpUnlessZero, &&LabEndOfFile,
+                                           &&LabZero, &&LabSum, &&LabMulAdd, &&LabAddMemPtr, &&LabMemScan, &&LabPrint};
+    const Instr* const start = instrs.data();
+    const Instr* IP = start + instrIndex;
+    unsigned char* cell = tapePtr;
+
+#define TIER_ZERO_DISPATCH() goto *handlers[IP->op]
+#define TIER_ZERO_NEXT() ++IP; TIER_ZERO_DISPATCH()
+#define TIER_ZERO_EXIT(index) tapePtr = cell; return (index)
+
+    TIER_ZERO_DISPATCH();
+
+  LabMoveRight:
+    ++cell;
+    TIER_ZERO_NEXT();
+  LabMoveLeft:
+    --cell;
+    TIER_ZERO_NEXT();
+  LabInc:
+    ++*cell;
+    TIER_ZERO_NEXT();
+  LabDec:
+    --*cell;
+    TIER_ZERO_NEXT();
+  LabWrite:
+    putchar(cell[IP->offset]);
+    TIER_ZERO_NEXT();
+  LabRead:
+    jitRead(cell + IP->offset);
+    TIER_ZERO_NEXT();
+  LabJumpIfZero: {
+    const auto index = static_cast<size_t>(IP - start);
+    if(cell[IP->offset] == 0) {
+      IP = start + matchingLoopBracket[index] + 1;
+      TIER_ZERO_DISPATCH();
+    }
+    if(hot[index + 1]) {
+      // entering a hot loop counts as a back edge of the loop around it, so an outer loop
+      // that runs hot loops becomes hot too instead of going back and forth every time
+      const size_t outer = enclosingLoop[index];
+      if(outer != NO_LOOP && ++backEdges[outer] >= threshold)
+        markHot(outer);
+      TIER_ZERO_EXIT(index + 1);
+    }
+    TIER_ZERO_NEXT();
+  }
+  LabJumpUnlessZero: {
+    if(cell[IP->offset] == 0) {
+      TIER_ZERO_NEXT();
+    }
+    const auto index = static_cast<size_t>(IP - start);
+    const size_t bodyIndex = matchingLoopBracket[index] + 1;
+    if(++backEdges[index] >= threshold) {
+      markHot(index);
+      TIER_ZERO_EXIT(bodyIndex);
+    }
+    IP = start + bodyIndex;
+    TIER_ZERO_DISPATCH();
+  }
+  LabEndOfFile:
+    TIER_ZERO_EXIT(instrs.size());
+  LabZero:
+    cell[IP->offset] = 0;
+    TIER_ZERO_NEXT();
+  LabSum:
+    cell[IP->offset] = static_cast<unsigned char>(cell[IP->offset] + IP->amount);
+    TIER_ZERO_NEXT();
+  LabMulAdd: {
+    const auto factor = static_cast<uint8_t>(IP->posInc ? -IP->amount : IP->amount);
+    cell[IP->offset] = static_cast<unsigned char>(cell[IP->offset] + cell[IP->srcOffset] * factor);
+    TIER_ZERO_NEXT();
+  }
+  LabAddMemPtr:
+    cell += IP->amount;
+    TIER_ZERO_NEXT();
+  LabMemScan:
+    cell = jitMemScan(cell + IP->offset, IP->amount) - IP->offset;
+    TIER_ZERO_NEXT();
+  LabPrint:
+    jitPrint(outputs[IP->stringId].data(), static_cast<size_t>(IP->amount));
+    TIER_ZERO_NEXT();
+
+#undef TIER_ZERO_DISPATCH
+#undef TIER_ZERO_NEXT
+#undef TIER_ZERO_EXIT
+  }
 
-  return;
+private:
+  static constexpr size_t NO_LOOP = SIZE_MAX;
+
+  // marks the body of the loop ending at rhs as hot
+  void markHot(const size_t rhs) {
+    fill(hot.begin() + static_cast<long>(matchingLoopBracket[rhs]) + 1, hot.begin() + static_cast<long>(rhs) + 1, true);
+  }
+
+  const vector<Instr>& instrs;
+  const vector<string>& outputs;
+  // the ] of each [, and the other way around
+  vector<size_t> matchingLoopBracket;
+  // the ] of the loop each [ is in, or NO_LOOP
+  vector<size_t> enclosingLoop;
+  // back edges taken by each loop, at the index of its ]
+  vector<size_t> backEdges;
+  // instructions in the body of a loop that took threshold back edges
+  vector<bool> hot;
+  size_t threshold;
+};
+
+// Starts in the interpreter, and runs loops in the JIT once they are hot
+void executeTiered(const vector<Instr>& instrs, const vector<string>& outputs, const MySettings& settings) {
+  jitInput.eof = settings.eof;
+  unsigned char* tapePtr = createJitTape();
+
+  TierZeroInterpreter interpreter(instrs, outputs, settings.tierUpThreshold);
+  BlockJit jit(instrs, outputs, settings.jitCodeCacheSize);
+  for(size_t instrIndex = 0; instrIndex < instrs.size(); )
+    instrIndex = interpreter.isHot(instrIndex) ? jit.run(instrIndex, tapePtr) : interpreter.run(instrIndex, tapePtr);
 }
 
 namespace llvm {
@@ -1468,27 +1455,178 @@ Function* generateMainPrototype(std::unique_ptr<LLVMContext>& TheContext, std::u
   return F;
 }
 
-// vector of all basic blocks, and a mapping for a label to a basic block
-pair<vector<BasicBlock*>, unordered_map<string, BasicBlock*>> generateBBStubs(const vector<unique_ptr<Instr>>& instrs, std::unique_ptr<Module>& TheModule, std::unique_ptr<LLVMContext>& TheContext, Function* func) {
+// vector of all basic blocks, and a mapping for a label index to a basic block
+pair<vector<BasicBlock*>, unordered_map<size_t, BasicBlock*>> generateBBStubs(const vector<Instr>& instrs, std::unique_ptr<Module>& TheModule, std::unique_ptr<LLVMContext>& TheContext, Function* func) {
   BasicBlock* entry = BasicBlock::Create(*TheContext, "entry", func);
   vector<BasicBlock*> BBs;
-  unordered_map<string, BasicBlock*> posMap;
+  unordered_map<size_t, BasicBlock*> posMap;
   BBs.push_back(entry);
 
   for(const auto& instr : instrs) {
-    if(const JumpInstr *const jump = dynamic_cast<JumpInstr*>(instr.get())) {
-      auto [ownlabel, targetlabel] = jump->getLabels();
-
-      BasicBlock* nextBB = BasicBlock::Create(*TheContext, ownlabel, func);
+    if(instr.op == JumpIfZero || instr.op == JumpUnlessZero) {
+      BasicBlock* nextBB = BasicBlock::Create(*TheContext, loopLabel(instr.loopId, instr.op), func);
       BBs.push_back(nextBB);
-      posMap[ownlabel] = nextBB;
+      posMap[labelIndex(instr.loopId, instr.op)] = nextBB;
     }
   }
 
   return {BBs, posMap};
 }
 
-void generateModule(const vector<unique_ptr<Instr>>& instrs) {
+struct OutputRuntime {
+  GlobalVariable* buffer;
+  GlobalVariable* length;
+  Function* flush;
+  Function* print;
+};
+
+/**
+ * @brief The same output buffer the assembly backend uses, as internal globals and functions:
+ *        bf_write_all(data, len) writes len bytes to stdout, retrying short writes
+ *        bf_flush_output() writes out and empties the buffer
+ *        bf_print(data, len) appends to the buffer, or writes directly when it doesn't fit
+ */
+OutputRuntime generateOutputRuntime() {
+  Type* i8PtrType = Builder->getInt8PtrTy();
+  Type* i64Type = Builder->getInt64Ty();
+  ArrayType* bufferType = ArrayType::get(Builder->getInt8Ty(), OUTPUT_BUFFER_SIZE);
+
+  auto* buffer = new GlobalVariable(*TheModule, bufferType, false, GlobalValue::InternalLinkage,
+                                    ConstantAggregateZero::get(bufferType), "bf_out_buf");
+  auto* length = new GlobalVariable(*TheModule, i64Type, false, GlobalValue::InternalLinkage,
+                                    Builder->getInt64(0), "bf_out_len");
+
+  FunctionType *writeType = FunctionType::get(i64Type, {Builder->getInt32Ty(), i8PtrType, i64Type}, false);
+  auto writeFunc = TheModule->getOrInsertFunction("write", writeType);
+
+  FunctionType *dataType = FunctionType::get(Builder->getVoidTy(), {i8PtrType, i64Type}, false);
+  Function* writeAll = Function::Create(dataType, Function::InternalLinkage, "bf_write_all", TheModule.get());
+  Function* flush = Function::Create(FunctionType::get(Builder->getVoidTy(), false), Function::InternalLinkage,
+                                     "bf_flush_output", TheModule.get());
+  Function* print = Function::Create(dataType, Function::InternalLinkage, "bf_print", TheModule.get());
+
+  // bf_write_all
+  {
+    BasicBlock* entry = BasicBlock::Create(*TheContext, "entry", writeAll);
+    BasicBlock* loop = BasicBlock::Create(*TheContext, "loop", writeAll);
+    BasicBlock* next = BasicBlock::Create(*TheContext, "next", writeAll);
+    BasicBlock* done = BasicBlock::Create(*TheContext, "done", writeAll);
+    Value* data = writeAll->getArg(0);
+    Value* len = writeAll->getArg(1);
+
+    Builder->SetInsertPoint(entry);
+    Builder->CreateBr(loop);
+
+    Builder->SetInsertPoint(loop);
+    PHINode* dataPhi = Builder->CreatePHI(i8PtrType, 2);
+    PHINode* lenPhi = Builder->CreatePHI(i64Type, 2);
+    dataPhi->addIncoming(data, entry);
+    lenPhi->addIncoming(len, entry);
+    Builder->CreateCondBr(Builder->CreateICmpSGT(lenPhi, Builder->getInt64(0)), next, done);
+
+    Builder->SetInsertPoint(next);
+    Value* written = Builder->CreateCall(writeFunc, {Builder->getInt32(1), dataPhi, lenPhi});
+    dataPhi->addIncoming(Builder->CreateGEP(Builder->getInt8Ty(), dataPhi, written), next);
+    lenPhi->addIncoming(Builder->CreateSub(lenPhi, written), next);
+    Builder->CreateCondBr(Builder->CreateICmpSGT(written, Builder->getInt64(0)), loop, done);
+
+    Builder->SetInsertPoint(done);
+    Builder->CreateRetVoid();
+  }
+
+  Value* bufferPtr = ConstantExpr::getPointerCast(buffer, i8PtrType);
+
+  // bf_flush_output
+  {
+    Builder->SetInsertPoint(BasicBlock::Create(*TheContext, "entry", flush));
+    Value* len = Builder->CreateLoad(i64Type, length);
+    Builder->CreateStore(Builder->getInt64(0), length);
+    Builder->CreateCall(writeAll, {bufferPtr, len});
+    Builder->CreateRetVoid();
+  }
+
+  // bf_print
+  {
+    BasicBlock* entry = BasicBlock::Create(*TheContext, "entry", print);
+    BasicBlock* full = BasicBlock::Create(*TheContext, "full", print);
+    BasicBlock* direct = BasicBlock::Create(*TheContext, "direct", print);
+    BasicBlock* copy = BasicBlock::Create(*TheContext, "copy", print);
+    Value* data = print->getArg(0);
+    Value* len = print->getArg(1);
+    Value* bufferSize = Builder->getInt64(OUTPUT_BUFFER_SIZE);
+
+    Builder->SetInsertPoint(entry);
+    Value* newLength = Builder->CreateAdd(Builder->CreateLoad(i64Type, length), len);
+    Builder->CreateCondBr(Builder->CreateICmpULE(newLength, bufferSize), copy, full);
+
+    Builder->SetInsertPoint(full);
+    Builder->CreateCall(flush);
+    Builder->CreateCondBr(Builder->CreateICmpUGE(len, bufferSize), direct, copy);
+
+    Builder->SetInsertPoint(direct);
+    Builder->CreateCall(writeAll, {data, len});
+    Builder->CreateRetVoid();
+
+    Builder->SetInsertPoint(copy);
+    Value* oldLength = Builder->CreateLoad(i64Type, length);
+    Builder->CreateMemCpy(Builder->CreateGEP(Builder->getInt8Ty(), bufferPtr, oldLength), MaybeAlign(1),
+                          data, MaybeAlign(1), len);
+    Builder->CreateStore(Builder->CreateAdd(oldLength, len), length);
+    Builder->CreateRetVoid();
+  }
+
+  return {buffer, length, flush, print};
+}
+
+struct InputRuntime {
+  GlobalVariable* buffer;
+  GlobalVariable* position;
+  GlobalVariable* end;
+  Function* refill;
+};
+
+/**
+ * @brief The input buffer of the assembly backend: bf_read_refill() reads the next block
+ *        and returns its first byte, or at end of input 0 with --eof 0 and -1 otherwise
+ */
+InputRuntime generateInputRuntime(const EofBehavior eof) {
+  Type* i64Type = Builder->getInt64Ty();
+  ArrayType* bufferType = ArrayType::get(Builder->getInt8Ty(), INPUT_BUFFER_SIZE);
+
+  auto* buffer = new GlobalVariable(*TheModule, bufferType, false, GlobalValue::InternalLinkage,
+                                    ConstantAggregateZero::get(bufferType), "bf_in_buf");
+  auto* position = new GlobalVariable(*TheModule, i64Type, false, GlobalValue::InternalLinkage,
+                                      Builder->getInt64(0), "bf_in_pos");
+  auto* end = new GlobalVariable(*TheModule, i64Type, false, GlobalValue::InternalLinkage,
+                                 Builder->getInt64(0), "bf_in_end");
+
+  FunctionType *readType = FunctionType::get(i64Type, {Builder->getInt32Ty(), Builder->getInt8PtrTy(), i64Type}, false);
+  auto readFunc = TheModule->getOrInsertFunction("read", readType);
+
+  Function* refill = Function::Create(FunctionType::get(Builder->getInt32Ty(), false), Function::InternalLinkage,
+                                      "bf_read_refill", TheModule.get());
+  BasicBlock* entry = BasicBlock::Create(*TheContext, "entry", refill);
+  BasicBlock* filled = BasicBlock::Create(*TheContext, "filled", refill);
+  BasicBlock* endOfInput = BasicBlock::Create(*TheContext, "eof", refill);
+
+  Builder->SetInsertPoint(entry);
+  Value* bufferPtr = ConstantExpr::getPointerCast(buffer, Builder->getInt8PtrTy());
+  Value* bytesRead = Builder->CreateCall(readFunc, {Builder->getInt32(0), bufferPtr, Builder->getInt64(INPUT_BUFFER_SIZE)});
+  Builder->CreateCondBr(Builder->CreateICmpSGT(bytesRead, Builder->getInt64(0)), filled, endOfInput);
+
+  Builder->SetInsertPoint(filled);
+  Builder->CreateStore(bytesRead, end);
+  Builder->CreateStore(Builder->getInt64(1), position);
+  Value* firstByte = Builder->CreateLoad(Builder->getInt8Ty(), bufferPtr);
+  Builder->CreateRet(Builder->CreateZExt(firstByte, Builder->getInt32Ty()));
+
+  Builder->SetInsertPoint(endOfInput);
+  Builder->CreateRet(Builder->getInt32(eof == EofBehavior::Zero ? 0 : static_cast<uint32_t>(-1)));
+
+  return {buffer, position, end, refill};
+}
+
+void generateModule(const vector<Instr>& instrs, const vector<string>& outputs, const MySettings& settings) {
   TheContext = make_unique<LLVMContext>();
   Builder = make_unique<IRBuilder<>>(*TheContext);
   TheModule = make_unique<Module>("module", *TheContext);
@@ -1496,12 +1634,16 @@ void generateModule(const vector<unique_ptr<Instr>>& instrs) {
   Function* prototype = generateMainPrototype(TheContext, TheModule);
   auto [blocks, labelToBBIndex] = generateBBStubs(instrs, TheModule, TheContext, prototype);
 
-  // ==== Set up reference to putchar and getchar ====
-  FunctionType *putcharType = FunctionType::get(Builder->getInt32Ty(), {Builder->getInt32Ty()}, false);
-  FunctionType *getcharType = FunctionType::get(Builder->getInt32Ty(), false);
+  // ==== Input and output go through our own buffers ====
+  const OutputRuntime output = generateOutputRuntime();
+  const InputRuntime input = generateInputRuntime(settings.eof);
 
-  auto putcharFunc = TheModule->getOrInsertFunction("putchar", putcharType);
-  auto getcharFunc = TheModule->getOrInsertFunction("getchar", getcharType);
+  vector<Constant*> outputGlobals;
+  for(const auto& outputString : outputs) {
+    Constant* data = ConstantDataArray::getString(*TheContext, outputString, false);
+    auto* global = new GlobalVariable(*TheModule, data->getType(), true, GlobalValue::PrivateLinkage, data, "output");
+    outputGlobals.push_back(ConstantExpr::getPointerCast(global, Builder->getInt8PtrTy()));
+  }
 
   // ==== initialize the tape ====
   Builder->SetInsertPoint(blocks[0]);
@@ -1523,19 +1665,26 @@ void generateModule(const vector<unique_ptr<Instr>>& instrs) {
 
   // This is a weird data structure, the label for the terminator of this block (name of next block)
   // will give the basic block and final memory pointer of that block for phi purposes
-  unordered_map<string, pair<BasicBlock*, Value*>> jnzFarPhiInfo;
+  unordered_map<size_t, pair<BasicBlock*, Value*>> jnzFarPhiInfo;
 
   size_t bbIndex = 0;
   Value* lastTapePos = midpointPtr;
+
+  // pointer to the cell at offset from the tape pointer
+  const auto cellPtr = [&](const int32_t offset) -> Value* {
+    if(offset == 0)
+      return lastTapePos;
+    return Builder->CreateGEP(i8Type, lastTapePos, Builder->getInt32(static_cast<uint32_t>(offset)));
+  };
   for(const auto& instr : instrs) {
-    switch(instr->op) {
+    switch(instr.op) {
       case MoveRight: {
         Value *increment = Builder->getInt32(1);
         lastTapePos = Builder->CreateGEP(i8Type, lastTapePos, increment);
         break;
       }
       case MoveLeft: {
-        Value *decrement = Builder->getInt32(-1);
+        Value *decrement = Builder->getInt32(static_cast<uint32_t>(-1));
         lastTapePos = Builder->CreateGEP(i8Type, lastTapePos, decrement);
         break;
       }
@@ -1554,27 +1703,80 @@ void generateModule(const vector<unique_ptr<Instr>>& instrs) {
         break;
       }
       case Write: {
-        Value *currentTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), lastTapePos);
-        Value *extendedVal = Builder->CreateZExt(currentTapeVal, Builder->getInt32Ty());
-        Builder->CreateCall(putcharFunc, {extendedVal});
+        // append to the output buffer inline, and only call out to flush it
+        Value *currentTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), cellPtr(instr.offset));
+        Value *length = Builder->CreateLoad(Builder->getInt64Ty(), output.length);
+        Value *slot = Builder->CreateInBoundsGEP(output.buffer->getValueType(), output.buffer, {Builder->getInt64(0), length});
+        Builder->CreateStore(currentTapeVal, slot);
+        Value *newLength = Builder->CreateAdd(length, Builder->getInt64(1));
+        Builder->CreateStore(newLength, output.length);
+
+        Value *mustFlush = Builder->CreateICmpEQ(newLength, Builder->getInt64(OUTPUT_BUFFER_SIZE));
+        if(settings.lineBuffered)
+          mustFlush = Builder->CreateOr(mustFlush, Builder->CreateICmpEQ(currentTapeVal, Builder->getInt8('\n')));
+
+        BasicBlock *nextBB = bbIndex + 1 < blocks.size() ? blocks[bbIndex + 1] : nullptr;
+        BasicBlock *flushBB = BasicBlock::Create(*TheContext, "flush", prototype, nextBB);
+        BasicBlock *afterBB = BasicBlock::Create(*TheContext, "written", prototype, nextBB);
+        Builder->CreateCondBr(mustFlush, flushBB, afterBB);
+        Builder->SetInsertPoint(flushBB);
+        Builder->CreateCall(output.flush);
+        Builder->CreateBr(afterBB);
+        Builder->SetInsertPoint(afterBB);
         break;
       }
       case Read: {
-        Value* retVal = Builder->CreateCall(getcharFunc);
-        Builder->CreateStore(retVal, lastTapePos);
+        // take the next byte from the input buffer inline, and only call out to refill it
+        BasicBlock *nextBB = bbIndex + 1 < blocks.size() ? blocks[bbIndex + 1] : nullptr;
+        BasicBlock *bufferedBB = BasicBlock::Create(*TheContext, "buffered", prototype, nextBB);
+        BasicBlock *refillBB = BasicBlock::Create(*TheContext, "refill", prototype, nextBB);
+        BasicBlock *storeBB = BasicBlock::Create(*TheContext, "store", prototype, nextBB);
+        BasicBlock *afterBB = BasicBlock::Create(*TheContext, "read", prototype, nextBB);
+
+        Value *position = Builder->CreateLoad(Builder->getInt64Ty(), input.position);
+        Value *end = Builder->CreateLoad(Builder->getInt64Ty(), input.end);
+        Builder->CreateCondBr(Builder->CreateICmpULT(position, end), bufferedBB, refillBB);
+
+        Builder->SetInsertPoint(bufferedBB);
+        Value *slot = Builder->CreateInBoundsGEP(input.buffer->getValueType(), input.buffer, {Builder->getInt64(0), position});
+        Value *bufferedVal = Builder->CreateLoad(Builder->getInt8Ty(), slot);
+        Builder->CreateStore(Builder->CreateAdd(position, Builder->getInt64(1)), input.position);
+        Builder->CreateBr(storeBB);
+
+        Builder->SetInsertPoint(refillBB);
+        // an interactive program's prompt has to be out before it waits for input
+        if(settings.lineBuffered)
+          Builder->CreateCall(output.flush);
+        Value *retVal = Builder->CreateCall(input.refill);
+        Value *refillVal = Builder->CreateTrunc(retVal, Builder->getInt8Ty());
+        if(settings.eof == EofBehavior::Unchanged)
+          Builder->CreateCondBr(Builder->CreateICmpSLT(retVal, Builder->getInt32(0)), afterBB, storeBB);
+        else
+          Builder->CreateBr(storeBB);
+
+        Builder->SetInsertPoint(storeBB);
+        PHINode *byteVal = Builder->CreatePHI(Builder->getInt8Ty(), 2);
+        byteVal->addIncoming(bufferedVal, bufferedBB);
+        byteVal->addIncoming(refillVal, refillBB);
+        Builder->CreateStore(byteVal, cellPtr(instr.offset));
+        Builder->CreateBr(afterBB);
+
+        Builder->SetInsertPoint(afterBB);
         break;
       }
       case JumpIfZero: {
         Value *zero = Builder->getInt8(0);
-        Value *currentTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), lastTapePos);
+        Value *currentTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), cellPtr(instr.offset));
         Value *isZero = Builder->CreateICmpEQ(currentTapeVal, zero);
-        const JumpInstr *const jump = dynamic_cast<JumpInstr*>(instr.get());
-        const auto& [ownlabel, targetlabel] = jump->getLabels();
+        const size_t ownlabel = labelIndex(instr.loopId, JumpIfZero);
+        const size_t targetlabel = labelIndex(instr.loopId, JumpUnlessZero);
 
         Builder->CreateCondBr(isZero, labelToBBIndex.at(targetlabel),blocks[bbIndex + 1]);
 
-        // now need to save information for phi nodes in the future
-        jnzFarPhiInfo[ownlabel] = {blocks[bbIndex], lastTapePos};
+        // now need to save information for phi nodes in the future,
+        // Writes may have split the block so this isn't always blocks[bbIndex]
+        BasicBlock* currentBB = Builder->GetInsertBlock();
+        jnzFarPhiInfo[ownlabel] = {currentBB, lastTapePos};
 
         // continue
         Builder->SetInsertPoint(blocks[++bbIndex]);
@@ -1582,25 +1784,25 @@ void generateModule(const vector<unique_ptr<Instr>>& instrs) {
         // the next block also needs a phi node, but unfortunately we can't complete it now
         PHINode* phi = Builder->CreatePHI(lastTapePos->getType(), 2);
 
-        phi->addIncoming(lastTapePos, blocks[bbIndex - 1]);
+        phi->addIncoming(lastTapePos, currentBB);
         // must later add one from the backedge block
         lastTapePos = phi;
         break;
       }
       case JumpUnlessZero: {
         Value *zero = Builder->getInt8(0);
-        Value *currentTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), lastTapePos);
+        Value *currentTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), cellPtr(instr.offset));
         Value *isNotZero = Builder->CreateICmpNE(currentTapeVal, zero);
-        const JumpInstr *const jump = dynamic_cast<JumpInstr*>(instr.get());
-        const auto& [ownlabel, targetlabel] = jump->getLabels();
+        const size_t targetlabel = labelIndex(instr.loopId, JumpIfZero);
 
         Builder->CreateCondBr(isNotZero, labelToBBIndex.at(targetlabel),blocks[bbIndex + 1]);
 
         // now must patch up the past block to have its phis all in a row
+        BasicBlock* currentBB = Builder->GetInsertBlock();
         auto targetBB = labelToBBIndex.at(targetlabel);
         auto& firstInstr = targetBB->front();
         if (auto *phiNode = dyn_cast<PHINode>(&firstInstr)) {
-          phiNode->addIncoming(lastTapePos, blocks[bbIndex]);
+          phiNode->addIncoming(lastTapePos, currentBB);
         }
         else
           throw invalid_argument("How did this block not have a phi node at the start?");
@@ -1610,46 +1812,42 @@ void generateModule(const vector<unique_ptr<Instr>>& instrs) {
         // create phi instruction to keep the world from collapsing
         PHINode* phi = Builder->CreatePHI(lastTapePos->getType(), 2);
 
-        phi->addIncoming(lastTapePos, blocks[bbIndex - 1]);
+        phi->addIncoming(lastTapePos, currentBB);
         auto& [otherBlock, otherTapePos] = jnzFarPhiInfo[targetlabel];
         phi->addIncoming(otherTapePos, otherBlock);
         lastTapePos = phi;
         break;
       }
       case EndOfFile: {
+        Builder->CreateCall(output.flush);
         Value *retVal = Builder->getInt32(0);
         Builder->CreateRet(retVal);
         break;
       }
       case Zero: {
         Value *zero = Builder->getInt8(0);
-        Builder->CreateStore(zero, lastTapePos);
+        Builder->CreateStore(zero, cellPtr(instr.offset));
         break;
       }
       case Sum: {
-        auto sum = dynamic_cast<SumInstr*>(instr.get());
-        auto [amount, offset] = sum->amountAndOffset();
-        Value *offsetVal = Builder->getInt32(offset);
+        Value *offsetVal = Builder->getInt32(static_cast<uint32_t>(instr.offset));
         auto offsetPtr = Builder->CreateGEP(i8Type, lastTapePos, offsetVal);
 
         Value *offsetValBefore = Builder->CreateLoad(Builder->getInt8Ty(), offsetPtr);
-        Value *sumAmount = Builder->getInt8(amount);
+        Value *sumAmount = Builder->getInt8(instr.amount);
         Value *newValue = Builder->CreateAdd(offsetValBefore, sumAmount);
         Builder->CreateStore(newValue, offsetPtr);
         break;
       }
       case MulAdd: {
-        auto muladd = dynamic_cast<MulAddInstr*>(instr.get());
-        auto [amount, offset, posInc] = muladd->amountOffsetPosInc();
-
-        Value *currTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), lastTapePos);
-        if(posInc)
+        Value *currTapeVal = Builder->CreateLoad(Builder->getInt8Ty(), cellPtr(instr.srcOffset));
+        if(instr.posInc)
           currTapeVal = Builder->CreateNeg(currTapeVal);
 
-        Value *mulAmount = Builder->getInt8(amount);
+        Value *mulAmount = Builder->getInt8(instr.amount);
         Value *mulResult = Builder->CreateMul(currTapeVal, mulAmount);
 
-        Value *offsetVal = Builder->getInt32(offset);
+        Value *offsetVal = Builder->getInt32(static_cast<uint32_t>(instr.offset));
         auto storePtr = Builder->CreateGEP(i8Type, lastTapePos, offsetVal);
         Value *offsetValBefore = Builder->CreateLoad(Builder->getInt8Ty(), storePtr);
         Value *newValue = Builder->CreateAdd(offsetValBefore, mulResult);
@@ -1658,15 +1856,18 @@ void generateModule(const vector<unique_ptr<Instr>>& instrs) {
         break;
       }
       case AddMemPtr: {
-        auto addMemPtrInstr = dynamic_cast<AddMemPointerInstr*>(instr.get());
-        int64_t amount = addMemPtrInstr->getAmount();
-
-        Value *increment = Builder->getInt32(amount);
+        Value *increment = Builder->getInt32(static_cast<uint32_t>(instr.amount));
         lastTapePos = Builder->CreateGEP(i8Type, lastTapePos, increment);
         break;
       }
+      case Print: {
+        Builder->CreateCall(output.print, {outputGlobals[instr.stringId], Builder->getInt64(static_cast<uint64_t>(instr.amount))});
+        if(settings.lineBuffered)
+          Builder->CreateCall(output.flush);
+        break;
+      }
       default: {
-        throw invalid_argument("Unsupported instruction for LLVM IR generation of " + to_string(instr->op));
+        throw invalid_argument("Unsupported instruction for LLVM IR generation of " + to_string(static_cast<int>(instr.op)));
       }
     }
   }
@@ -1701,24 +1902,32 @@ int main(int argc, char** argv) {
     cerr << "Note: Vectorized mem scans are not currently supported when generating LLVM IR" << endl;
   }
 
-  const vector<Op> ops = readFile(settings.infile.value());
+  const vector<OpRun> ops = readFile(settings.infile.value());
 
   if(!checkValidInstrs(ops)) {
     cerr << "Loop brackets do not match, aborting." << endl;
     exit(-1);
   }
 
-  vector<unique_ptr<Instr>> instrs = parse(ops);
+  vector<Instr> instrs = parse(ops, settings);
 
-  if(settings.justInTime) {
-    executeJIT(instrs);
+  if(settings.justInTime || settings.tiered || settings.eagerJit) {
+    vector<string> outputs;
+    instrs = optimize(std::move(instrs), settings, outputs);
+    if(settings.tiered)
+      executeTiered(instrs, outputs, settings);
+    else if(settings.eagerJit)
+      executeEagerJIT(instrs, outputs, settings);
+    else
+      executeJIT(instrs, outputs, settings);
     return EXIT_SUCCESS;
   }
 
-  instrs = optimize(instrs, settings);
+  vector<string> outputs;
+  instrs = optimize(std::move(instrs), settings, outputs);
 
   if(settings.llvm) {
-    llvm::generateModule(instrs);
+    llvm::generateModule(instrs, outputs, settings);
 
     if(!settings.outfile)
       TheModule->print(llvm::outs(), nullptr);    
@@ -1731,7 +1940,7 @@ int main(int argc, char** argv) {
     return EXIT_SUCCESS;
   }
 
-  string program = compile(instrs);
+  string program = compile(instrs, outputs, settings);
 
   if(!settings.outfile)
     cout << program << endl;
@@ -0,0 +1,31 @@
+import os
+import subprocess
+import sys
+import tempfile
+import time
+from os.path import join
+
+# Times compiling largeprograms/Sudoku.bf and concatenations of it, and
+# reports the compiler's peak RSS, to check that it scales linearly with
+# program size:
+#   python3 doCompileScaling.py [compiler.out] [copies ...]
+
+compiler = sys.argv[1] if len(sys.argv) > 1 else "./compiler.out"
+copies = [int(arg) for arg in sys.argv[2:]] or [1, 2, 4, 8]
+
+with open("largeprograms/Sudoku.bf") as file:
+  source = file.read()
+
+with tempfile.TemporaryDirectory() as tmpdir:
+  for count in copies:
+    program = join(tmpdir, f"sudoku{count}x.bf")
+    with open(program, "w") as file:
+      file.write(source * count)
+
+    time_start = time.time()
+    process = subprocess.Popen(
+      [compiler, program, "-o", join(tmpdir, "out.s")]
+    )
+    _, _, usage = os.wait4(process.pid, 0)
+    time_elapsed = time.time() - time_start
+    print(f"{count}x: {time_elapsed:.2f}s, {usage.ru_maxrss / 1024:.1f} MB peak RSS", flush=True)
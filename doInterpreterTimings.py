@@ -0,0 +1,29 @@
+import subprocess
+import sys
+import time
+
+# Compares interpreter builds on the branch-heavy benchmarks, e.g. a build
+# of the previous commit against the current one:
+#   python3 doInterpreterTimings.py old/interpreter.out build/interpreter.out
+
+benches = ["mandel.b", "hanoi.b"]
+interpreters = sys.argv[1:]
+
+if not interpreters:
+  print("Usage: python3 doInterpreterTimings.py <interpreter.out> [<interpreter.out> ...]")
+  sys.exit(1)
+
+print("bench".ljust(12) + "".join(path.rjust(32) for path in interpreters))
+
+for file in benches:
+  timings = []
+
+  for interpreter in interpreters:
+    time_start = time.time()
+    subprocess.run(
+      [interpreter, f"benches/{file}"],
+      stdout=subprocess.DEVNULL
+    )
+    timings.append(time.time() - time_start)
+
+  print(file.ljust(12) + "".join(f"{timing:.2f}s".rjust(32) for timing in timings))
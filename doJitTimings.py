@@ -0,0 +1,63 @@
+import os
+import pty
+import statistics
+import subprocess
+import sys
+import time
+
+# Compares the lazy JIT to the eager whole-program JIT: how long until a
+# program's first output shows up on a terminal, and how long it runs in
+# total. Output goes to a pseudo-terminal, so it is line buffered like it is
+# interactively. Programs can name a file to read input from after a colon:
+#   python3 doJitTimings.py [compiler.out] [program[:input] ...]
+
+compiler = sys.argv[1] if len(sys.argv) > 1 else "./compiler.out"
+programs = sys.argv[2:] or [
+  "benches/hello.b", "benches/twinkle.b", "benches/bottles.b", "benches/hanoi.b",
+  "benches/long.b", "benches/mandel.b",
+]
+modes = {
+  "lazy": ["--just-in-time", "true"],
+  "eager": ["--eager-jit", "true"],
+}
+runs = 5
+
+
+def run(command, input_path):
+  master, slave = pty.openpty()
+  with open(input_path or os.devnull) as stdin:
+    time_start = time.perf_counter()
+    process = subprocess.Popen(command, stdin=stdin, stdout=slave, stderr=subprocess.DEVNULL)
+  os.close(slave)
+
+  first_output = None
+  while True:
+    try:
+      data = os.read(master, 1 << 16)
+    except OSError:
+      # the terminal is gone once the program exits
+      break
+    if not data:
+      break
+    if first_output is None:
+      first_output = time.perf_counter() - time_start
+
+  process.wait()
+  total = time.perf_counter() - time_start
+  os.close(master)
+  return first_output, total
+
+
+for program in programs:
+  path, _, input_path = program.partition(":")
+  results = []
+  for mode, flags in modes.items():
+    timings = [run([compiler, path] + flags, input_path) for _ in range(runs)]
+    first_outputs = [first for first, _ in timings if first is not None]
+    total = statistics.median(total for _, total in timings)
+    if first_outputs:
+      first_output = f"first output {statistics.median(first_outputs) * 1000:.1f}ms"
+    else:
+      first_output = "no output"
+    results.append(f"{mode} {first_output}, total {total * 1000:.1f}ms")
+  print(f"{path}: " + "; ".join(results), flush=True)
@@ -6,77 +6,285 @@
 #include <utility>
 #include <array>
 #include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ir.h"
 
 using namespace std;
 
 static bool profile = 0;
 
 
-enum Op {
-  MoveRight,
-  MoveLeft,
-  Inc,
-  Dec,
-  Write,
-  Read,
-  JumpIfZero,
-  JumpUnlessZero,
-  EndOfFile
+// Compact form of the optimized IR that the interpreter runs. Eight bytes
+// per instruction, so a cache line holds eight of them.
+struct Bytecode {
+  uint8_t op;
+  uint8_t amount;      // addend for Sum, factor for MulAdd
+  int16_t cellOffset;  // cell read by MulAdd, acted on by Zero/Write/Read, compared by [ and ],
+                       // where MemScan starts
+  int32_t offset;      // cell offset for Sum/MulAdd, pointer delta for AddMemPtr, stride for MemScan,
+                       // relative jump target for [ and ]
 };
 
-array<char, EndOfFile> enumToChar{{'>', '<', '+', '-', '.', ',', '[', ']'}};
-array<size_t, EndOfFile> instrFreq;
+vector<Bytecode> lowerToBytecode(const vector<Instr>& instrs) {
+  vector<Bytecode> code;
+  code.reserve(instrs.size());
 
-unordered_map<string, size_t> loopFreq;
-unordered_map<size_t, string> loopAtIndex;
-unordered_map<string, bool> isSimpleLoop;
+  for(const auto& instr : instrs) {
+    Bytecode bytecode{static_cast<uint8_t>(instr.op), 0, 0, 0};
 
-
-vector<Op> readFile(string fileName) {
-  ifstream fileStream(fileName);
-
-  if(!fileStream.is_open()) {
-    cerr << "Unable to open file " << fileName << endl;
-    exit(-1);
-  }
-
-  vector<Op> retVec;
-
-  char currChar;
-  while(fileStream.get(currChar)) {
-    switch(currChar) {
-      case '>':
-        retVec.push_back(MoveRight);
+    switch(instr.op) {
+      case Sum: {
+        bytecode.amount = static_cast<uint8_t>(instr.amount);
+        bytecode.offset = instr.offset;
         break;
-      case '<':
-        retVec.push_back(MoveLeft);
-        break;
-      case '+':
-        retVec.push_back(Inc);
-        break;
-      case '-':
-        retVec.push_back(Dec);
-        break;
-      case '.':
-        retVec.push_back(Write);
+      }
+      case MulAdd: {
+        // fold the sign of the induction variable into the factor
+        bytecode.amount = static_cast<uint8_t>(instr.posInc ? -instr.amount : instr.amount);
+        bytecode.cellOffset = static_cast<int16_t>(instr.srcOffset);
+        bytecode.offset = instr.offset;
         break;
-      case ',':
-        retVec.push_back(Read);
+      }
+      case AddMemPtr: {
+        bytecode.offset = instr.amount;
         break;
-      case '[':
-        retVec.push_back(JumpIfZero);
+      }
+      case MemScan: {
+        bytecode.cellOffset = static_cast<int16_t>(instr.offset);
+        bytecode.offset = instr.amount;
         break;
-      case ']':
-        retVec.push_back(JumpUnlessZero);
+      }
+      case EndOfFile:
         break;
       default:
-        continue;
+        // propagateOffsets keeps these within 16 bits
+        bytecode.cellOffset = static_cast<int16_t>(instr.offset);
+        break;
     }
+
+    code.push_back(bytecode);
   }
 
-  retVec.push_back(EndOfFile);
+  return code;
+}
 
-  return retVec;
+// Furthest an access can land past the tape when the previous access was on
+// it: back from the largest cell offset to the pointer, across the moves in
+// between, then out to the largest cell offset again. Every op other than the
+// pointer moves touches a cell, and so do the brackets that jumps land after,
+// so the moves in between are a straight run of MoveRight, MoveLeft and AddMemPtr.
+// MemScan steps a stride at a time from a cell on the tape.
+size_t maxTapeReach(const vector<Bytecode>& code) {
+  size_t maxOffset = 0, maxMove = 0, move = 0;
+  for(const auto& bytecode : code) {
+    maxOffset = max(maxOffset, static_cast<size_t>(abs(bytecode.cellOffset)));
+
+    if(bytecode.op == MoveRight || bytecode.op == MoveLeft)
+      ++move;
+    else if(bytecode.op == AddMemPtr)
+      move += static_cast<size_t>(abs(bytecode.offset));
+    else
+      move = 0;
+
+    if(bytecode.op == Sum || bytecode.op == MulAdd)
+      maxOffset = max(maxOffset, static_cast<size_t>(abs(bytecode.offset)));
+    else if(bytecode.op == MemScan)
+      maxMove = max(maxMove, static_cast<size_t>(abs(bytecode.offset)));
+    maxMove = max(maxMove, move);
+  }
+  return 2 * maxOffset + maxMove + 1;
+}
+
+// Furthest below the pointer that any op accesses
+ptrdiff_t maxLowReach(const vector<Bytecode>& code) {
+  ptrdiff_t reach = 0;
+  for(const auto& bytecode : code) {
+    reach = max<ptrdiff_t>(reach, -bytecode.cellOffset);
+    if(bytecode.op == Sum || bytecode.op == MulAdd)
+      reach = max<ptrdiff_t>(reach, -static_cast<ptrdiff_t>(bytecode.offset));
+  }
+  return reach;
+}
+
+// Ops that access a cell through the pointer, and so have a checked form for
+// when the pointer is near the start of the tape
+constexpr bool accessesCell(const uint8_t op) {
+  return op != MoveRight && op != MoveLeft && op != EndOfFile && op != AddMemPtr && op != MemScan;
+}
+
+constexpr size_t TAPE_SIZE = 320'000;
+
+// Bounds of the tape and its guard regions, for the SIGSEGV handler
+static unsigned char* tapeLowGuard = nullptr;
+static unsigned char* tapeHighGuard = nullptr;
+static size_t tapeGuardSize = 0;
+
+// Writes all of data to fd, using only async-signal-safe calls
+void writeAll(const int fd, const char* data, size_t size) {
+  while(size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if(written < 0 && errno == EINTR)
+      continue;
+    if(written <= 0)
+      return;
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+// Program output is buffered here instead of in cout, so that a tape error
+// raised from the SIGSEGV handler can still flush it with write(2). On a
+// terminal it is flushed at every newline and before every read, like stdout.
+static char outputBuffer[1 << 16];
+static size_t outputLength = 0;
+static const bool outputIsTerminal = isatty(STDOUT_FILENO);
+
+void flushOutput() {
+  writeAll(STDOUT_FILENO, outputBuffer, outputLength);
+  outputLength = 0;
+}
+
+inline void writeOutput(const unsigned char c) {
+  outputBuffer[outputLength++] = static_cast<char>(c);
+  if(outputLength == sizeof(outputBuffer) || (c == '\n' && outputIsTerminal))
+    flushOutput();
+}
+
+// Flushes the program's output, reports message and exits. It skips atexit
+// handlers and stdio, so it is safe to call from the SIGSEGV handler.
+[[noreturn]] void tapeError(const char* message) {
+  flushOutput();
+  writeAll(STDERR_FILENO, message, strlen(message));
+  _exit(-1);
+}
+
+void tapeFaultHandler(int, siginfo_t* info, void*) {
+  const auto *const addr = static_cast<unsigned char*>(info->si_addr);
+
+  // The fault comes from a tape access in interpret() or from memchr and
+  // memrchr scanning in scanForZero(), never while output is being buffered
+  if(addr >= tapeLowGuard && addr < tapeLowGuard + tapeGuardSize)
+    tapeError("Underflowed tape size\n");
+  if(addr >= tapeHighGuard && addr < tapeHighGuard + tapeGuardSize)
+    tapeError("Overflowed tape size\n");
+
+  // not ours, let the access fault again with the default action
+  signal(SIGSEGV, SIG_DFL);
+}
+
+// mmap'd tape between two PROT_NONE guard regions, each at least as large
+// as maxTapeReach(), so running off the tape faults instead of needing a
+// bounds check on every pointer move. Guards start on a page boundary, so the
+// end of the tape is placed right against the high guard, and the tape's first
+// page is padded below cell 0. Accesses to the padding do not fault, so
+// interpret() checks accesses itself while the pointer is near cell 0.
+struct GuardedTape {
+  explicit GuardedTape(const size_t reach) {
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t tapeBytes = (TAPE_SIZE + pageSize - 1) / pageSize * pageSize;
+    tapeGuardSize = (reach + pageSize - 1) / pageSize * pageSize;
+    mappingSize = tapeBytes + 2 * tapeGuardSize;
+
+    void* mapping = mmap(nullptr, mappingSize, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if(mapping == MAP_FAILED) {
+      cerr << "Unable to allocate tape" << endl;
+      exit(-1);
+    }
+
+    tapeLowGuard = static_cast<unsigned char*>(mapping);
+    tapeHighGuard = tapeLowGuard + tapeGuardSize + tapeBytes;
+    cells = tapeHighGuard - TAPE_SIZE;
+    mprotect(tapeLowGuard + tapeGuardSize, tapeBytes, PROT_READ | PROT_WRITE);
+
+    struct sigaction action {};
+    action.sa_sigaction = tapeFaultHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, nullptr);
+  }
+
+  ~GuardedTape() {
+    signal(SIGSEGV, SIG_DFL);
+    munmap(tapeLowGuard, mappingSize);
+  }
+
+  unsigned char* cells;
+
+private:
+  size_t mappingSize;
+};
+
+// Cells to check in a block of 16 for each stride up to 16: every stride-th
+// bit from the bottom going forward, from the top going backward
+constexpr array<uint16_t, 16> makeScanMasks(const bool backward) {
+  array<uint16_t, 16> masks{};
+  for(size_t stride = 1; stride <= 16; ++stride) {
+    for(size_t bit = 0; bit < 16; bit += stride)
+      masks[stride - 1] |= static_cast<uint16_t>(1 << (backward ? 15 - bit : bit));
+  }
+  return masks;
+}
+
+constexpr array<uint16_t, 16> forwardScanMasks = makeScanMasks(false);
+constexpr array<uint16_t, 16> backwardScanMasks = makeScanMasks(true);
+
+// First zero cell at or past cell in steps of stride. Blocks of 16 cells are
+// only loaded while they lie on the tape. Past that, and for strides wider
+// than a block, cells are checked one at a time, so running off the tape
+// faults in a guard region. The padding below the tape does not fault, so
+// scans that end up there are caught here.
+const unsigned char* scanForZero(const unsigned char* cell, const int32_t stride) {
+  const unsigned char *const tapeBegin = tapeHighGuard - TAPE_SIZE;
+  if(cell < tapeBegin)
+    tapeError("Underflowed tape size\n");
+
+  if(stride == 1 || stride == -1) {
+    const void* zeroCell = (stride == 1) ? memchr(cell, 0, static_cast<size_t>(tapeHighGuard - cell))
+                                         : memrchr(tapeBegin, 0, static_cast<size_t>(cell - tapeBegin + 1));
+    if(!zeroCell)
+      tapeError((stride == 1) ? "Overflowed tape size\n" : "Underflowed tape size\n");
+    return static_cast<const unsigned char*>(zeroCell);
+  }
+
+#ifdef __SSE2__
+  const size_t absStride = static_cast<size_t>(abs(stride));
+  if(absStride <= 16) {
+    const __m128i zero = _mm_setzero_si128();
+    const ptrdiff_t step = static_cast<ptrdiff_t>(16 / absStride * absStride);
+
+    if(stride > 0) {
+      const uint32_t mask = forwardScanMasks[absStride - 1];
+      for(; cell + 16 <= tapeHighGuard; cell += step) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cell));
+        const uint32_t zeroCells = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero))) & mask;
+        if(zeroCells)
+          return cell + __builtin_ctz(zeroCells);
+      }
+    }
+    else {
+      const uint32_t mask = backwardScanMasks[absStride - 1];
+      for(; cell - 15 >= tapeBegin; cell -= step) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cell - 15));
+        const uint32_t zeroCells = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero))) & mask;
+        if(zeroCells)
+          return cell - __builtin_clz(zeroCells) + 16;
+      }
+    }
+  }
+#endif
+
+  while(*cell != 0)
+    cell += stride;
+  if(cell < tapeBegin)
+    tapeError("Underflowed tape size\n");
+  return cell;
 }
 
 bool checkSimpleLoop(const vector<Op>& code) {
@@ -102,128 +310,342 @@ bool checkSimpleLoop(const vector<Op>& code) {
   return currMemOffset == 0;
 }
 
-unordered_map<size_t, size_t> initializeLoopBrackets(const vector<Op>& code) {
+// Stores the jump to just past the matching bracket in each bracket's
+// offset, relative to the bracket itself
+void resolveLoopJumps(vector<Bytecode>& code) {
   stack<size_t> leftBrackLocs;
-  unordered_map<size_t, size_t> loopMap;
-  bool canBeInnerLoop = false;
 
   for(size_t i = 0; i < code.size(); ++i) {
-    if(code[i] == JumpIfZero) {
+    if(code[i].op == JumpIfZero)
       leftBrackLocs.push(i);
-
-      canBeInnerLoop = true;
-    }
-    else if(code[i] == JumpUnlessZero) {
+    else if(code[i].op == JumpUnlessZero) {
       const size_t lhs = leftBrackLocs.top();
-      loopMap[lhs] = i;
-      loopMap[i] = lhs;
+      code[lhs].offset = static_cast<int32_t>(i - lhs + 1);
+      code[i].offset = -static_cast<int32_t>(i - lhs - 1);
       leftBrackLocs.pop();
+    }
+  }
+}
+
+// Direct threading needs labels as values, a GCC/Clang extension. Other
+// compilers, or builds with -DBF_SWITCH_DISPATCH, fall back to a switch loop.
+#if defined(__GNUC__) && !defined(BF_SWITCH_DISPATCH)
+#define BF_DIRECT_THREADED
+#endif
+
+#ifdef BF_DIRECT_THREADED
+// Bytecode with its op replaced by the address of the op's handler
+struct ThreadedBytecode {
+  const void* handler;
+  uint8_t amount;
+  int16_t cellOffset;
+  int32_t offset;
+};
 
-      if(profile && canBeInnerLoop) {
-        const vector<Op> loopCode = vector(code.begin() + static_cast<long>(lhs), code.begin() + static_cast<long>(i) + 1);
-        vector<char> loopChars(loopCode.size());
-        transform(loopCode.cbegin(), loopCode.cend(), loopChars.begin(), [&](Op a){return enumToChar[a];});
-        string loopString(loopChars.begin(), loopChars.end());
+#define HANDLER(op) Lab##op
+#define DISPATCH() goto *IP->handler
+#else
+#define HANDLER(op) case op
+#define DISPATCH() continue
+#endif
+
+#define NEXT() ++IP; DISPATCH()
+
+// Checked form of an op, which tests that the cell at offset is not below the
+// start of the tape and then runs the op's handler
+#ifdef BF_DIRECT_THREADED
+#define CHECKED_HANDLER(op, offset) LabChecked##op: CHECK_ACCESS(offset);
+#else
+constexpr uint8_t CHECKED_OP = 0x80;
+#define CHECKED_HANDLER(op, offset) case op | CHECKED_OP: CHECK_ACCESS(offset); [[fallthrough]];
+#endif
+
+#define CHECK_ACCESS(offset) \
+  if(static_cast<ptrdiff_t>(index) < -static_cast<ptrdiff_t>(offset)) \
+    tapeError("Underflowed tape size\n")
+
+// After every pointer move: once the pointer is closer to cell 0 than an op
+// can reach below it, accesses could land in the padding below the tape, so
+// every op is switched to its checked form for the rest of the run
+#define CHECK_LOW_REACH() \
+  if(static_cast<ptrdiff_t>(index) < lowReach) { \
+    lowReach = PTRDIFF_MIN; \
+    checkAccesses(); \
+  }
+
+// Profiling policies for interpret(). Every hook of NoProfiler is empty, so
+// the non-profiling interpreter carries no profiling code at all.
+struct NoProfiler {
+  void countOp(Op) {}
+  void countLoopEntry(size_t) {}
+};
+
+// Counts ops and iterations of innermost loops. Loops get dense ids up front,
+// so counting is an array increment and loop strings are only built for the report.
+struct Profiler {
+  explicit Profiler(const vector<Bytecode>& code) : loopIdAtIndex(code.size()) {
+    stack<size_t> leftBrackLocs;
+    bool canBeInnerLoop = false;
+
+    // id 0 collects all loops that are not innermost
+    loopBounds.push_back({0, 0});
+
+    for(size_t i = 0; i < code.size(); ++i) {
+      if(code[i].op == JumpIfZero) {
+        leftBrackLocs.push(i);
 
-        loopAtIndex[lhs] = loopString;
-        loopFreq[loopString] = 0;
-        isSimpleLoop[loopString] = checkSimpleLoop(loopCode);
+        canBeInnerLoop = true;
       }
+      else if(code[i].op == JumpUnlessZero) {
+        const size_t lhs = leftBrackLocs.top();
+        leftBrackLocs.pop();
 
-      canBeInnerLoop = false;
+        if(canBeInnerLoop) {
+          loopIdAtIndex[lhs] = static_cast<uint32_t>(loopBounds.size());
+          loopBounds.push_back({lhs, i});
+        }
+
+        canBeInnerLoop = false;
+      }
     }
+
+    loopFreq.resize(loopBounds.size());
   }
 
-  return loopMap;
-}
+  void countOp(Op op) {
+    ++instrFreq[op];
+  }
 
-void interpret(const vector<Op>& ops) {
-  constexpr size_t TAPE_SIZE = 320'000;
-  unsigned char tape[TAPE_SIZE]{};
+  void countLoopEntry(size_t lhs) {
+    ++loopFreq[loopIdAtIndex[lhs]];
+  }
+
+  void report(const vector<Bytecode>& code) const {
+    cout << "\n\n=====PROFILING=====\n";
+    vector<pair<char, size_t>> instrFreqVec;
+    for(size_t instrType = 0; instrType < EndOfFile; ++instrType) {
+      instrFreqVec.push_back({enumToChar[instrType], instrFreq[instrType]});
+    }
+
+    sort(instrFreqVec.begin(), instrFreqVec.end(), [&](auto a, auto b){return a.second > b.second;});
+
+    for(const auto& [op, freq] : instrFreqVec) {
+      cout << op << " : " << freq << "\n";
+    }
+
+    // now onto loops, identical loops at different places are reported together
+    unordered_map<string, size_t> freqOfLoop;
+    unordered_map<string, bool> isSimpleLoop;
+
+    for(size_t loopId = 1; loopId < loopBounds.size(); ++loopId) {
+      const auto& [lhs, rhs] = loopBounds[loopId];
+
+      // profiling runs unoptimized, so every bytecode is a single source op
+      vector<Op> loopCode(rhs - lhs + 1);
+      transform(code.begin() + static_cast<long>(lhs), code.begin() + static_cast<long>(rhs) + 1, loopCode.begin(), [&](Bytecode a){return static_cast<Op>(a.op);});
+      vector<char> loopChars(loopCode.size());
+      transform(loopCode.cbegin(), loopCode.cend(), loopChars.begin(), [&](Op a){return enumToChar[a];});
+      string loopString(loopChars.begin(), loopChars.end());
+
+      freqOfLoop[loopString] += loopFreq[loopId];
+      isSimpleLoop[loopString] = checkSimpleLoop(loopCode);
+    }
+
+    vector<pair<string, size_t>> simpleLoopFreq, complexLoopFreq;
+
+    for(const auto& [loop, freq] : freqOfLoop) {
+      if(isSimpleLoop[loop])
+        simpleLoopFreq.push_back({loop, freq});
+      else
+        complexLoopFreq.push_back({loop, freq});
+    }
+
+    sort(simpleLoopFreq.begin(), simpleLoopFreq.end(), [&](auto a, auto b){return a.second > b.second;});
+    sort(complexLoopFreq.begin(), complexLoopFreq.end(), [&](auto a, auto b){return a.second > b.second;});
+
+    cout << "\n===Simple Loops===\n";
+    for(const auto& [loop, freq] : simpleLoopFreq) {
+      cout << loop << " : " << freq << "\n";
+    }
+
+    cout << "\n===Complex Loops===\n";
+    for(const auto& [loop, freq] : complexLoopFreq) {
+      cout << loop << " : " << freq << "\n";
+    }
+  }
+
+private:
+  array<size_t, EndOfFile> instrFreq{};
+  vector<size_t> loopFreq;
+  vector<uint32_t> loopIdAtIndex;
+  vector<pair<size_t, size_t>> loopBounds;
+};
+
+template<typename ProfilingPolicy>
+void interpret(const vector<Bytecode>& code, ProfilingPolicy& profiler) {
+  GuardedTape guardedTape(maxTapeReach(code));
+  unsigned char *const tape = guardedTape.cells;
   size_t index = TAPE_SIZE / 2;
 
-  unordered_map<size_t, size_t> matchingLoopBracket = initializeLoopBrackets(ops);
+  // drops to PTRDIFF_MIN once the ops are checked, so they are only switched once
+  ptrdiff_t lowReach = maxLowReach(code);
 
+#ifdef BF_DIRECT_THREADED
   static const void* jumpTable[] = {&&LabMoveRight, &&LabMoveLeft, &&LabInc, &&LabDec, &&LabWrite, 
-                                    &&LabRead, &&LabJumpIfZero, &&LabJumpUnlessZero, &&LabEndOfFile};
+                                    &&LabRead, &&LabJumpIfZero, &&LabJumpUnlessZero, &&LabEndOfFile,
+                                    &&LabZero, &&LabSum, &&LabMulAdd, &&LabAddMemPtr, &&LabMemScan};
+  static const void* checkedJumpTable[] = {&&LabMoveRight, &&LabMoveLeft, &&LabCheckedInc, &&LabCheckedDec,
+                                           &&LabCheckedWrite, &&LabCheckedRead, &&LabCheckedJumpIfZero,
+                                           &&LabCheckedJumpUnlessZero, &&LabEndOfFile, &&LabCheckedZero,
+                                           &&LabCheckedSum, &&LabCheckedMulAdd, &&LabAddMemPtr, &&LabMemScan};
+
+  // resolve every op to its handler address once, up front
+  vector<ThreadedBytecode> threaded(code.size());
+  transform(code.begin(), code.end(), threaded.begin(), [&](Bytecode a){return ThreadedBytecode{jumpTable[a.op], a.amount, a.cellOffset, a.offset};});
+
+  auto checkAccesses = [&]() {
+    for(size_t i = 0; i < code.size(); ++i)
+      threaded[i].handler = checkedJumpTable[code[i].op];
+  };
+
+  const ThreadedBytecode *const start = threaded.data();
+  const ThreadedBytecode* IP = start;
+  CHECK_LOW_REACH();
+  DISPATCH();
+#else
+  vector<Bytecode> program(code);
+
+  auto checkAccesses = [&]() {
+    for(auto& bytecode : program) {
+      if(accessesCell(bytecode.op))
+        bytecode.op |= CHECKED_OP;
+    }
+  };
 
-  size_t IP = 0;
-  goto *jumpTable[ops[IP]];
+  const Bytecode *const start = program.data();
+  const Bytecode* IP = start;
+  CHECK_LOW_REACH();
 
-LabMoveRight: {
-    if(index >= TAPE_SIZE - 1) {
-      cerr << "Overflowed tape size" << endl;
-      exit(-1);
-    }
-    if(profile)
-      ++instrFreq[MoveRight];
+  for(;;) switch(IP->op) {
+#endif
+
+HANDLER(MoveRight): {
+    profiler.countOp(MoveRight);
     ++index;
-    goto *jumpTable[ops[++IP]];
+    NEXT();
   } 
-LabMoveLeft: {
-    if(index == 0) {
-      cerr << "Underflowed tape size" << endl;
-      exit(-1);
-    }
-    if(profile)
-      ++instrFreq[MoveLeft];
+HANDLER(MoveLeft): {
+    profiler.countOp(MoveLeft);
 
     --index;
-    goto *jumpTable[ops[++IP]];
+    CHECK_LOW_REACH();
+    NEXT();
   } 
-LabInc: {
-    if(profile)
-      ++instrFreq[Inc];
+CHECKED_HANDLER(Inc, 0)
+HANDLER(Inc): {
+    profiler.countOp(Inc);
 
     ++tape[index];
-    goto *jumpTable[ops[++IP]];
+    NEXT();
   } 
-LabDec: {
-    if(profile)
-      ++instrFreq[Dec];
+CHECKED_HANDLER(Dec, 0)
+HANDLER(Dec): {
+    profiler.countOp(Dec);
 
     --tape[index];
-    goto *jumpTable[ops[++IP]];
+    NEXT();
   } 
-LabWrite: {
-    if(profile)
-      ++instrFreq[Write];
+CHECKED_HANDLER(Write, IP->cellOffset)
+HANDLER(Write): {
+    profiler.countOp(Write);
 
-    cout << tape[index];
-    goto *jumpTable[ops[++IP]];
+    const unsigned char *const cell = tape + index;
+    writeOutput(cell[IP->cellOffset]);
+    NEXT();
   } 
-LabRead: {
-    if(profile)
-      ++instrFreq[Read];
+CHECKED_HANDLER(Read, IP->cellOffset)
+HANDLER(Read): {
+    profiler.countOp(Read);
+
+    if(outputIsTerminal)
+      flushOutput();
 
-    tape[index] = getchar();
-    goto *jumpTable[ops[++IP]];
+    unsigned char *const cell = tape + index;
+    cell[IP->cellOffset] = static_cast<unsigned char>(getchar());
+    NEXT();
   } 
-LabJumpIfZero: {
-    if(profile)
-      ++instrFreq[JumpIfZero];
+CHECKED_HANDLER(JumpIfZero, IP->cellOffset)
+HANDLER(JumpIfZero): {
+    profiler.countOp(JumpIfZero);
 
-    if(tape[index] == 0) {
-      IP = matchingLoopBracket[IP];
-      goto *jumpTable[ops[IP]];
+    const unsigned char *const cell = tape + index;
+    if(cell[IP->cellOffset] == 0) {
+      // the jump skips the ] check, so count it here instead
+      profiler.countOp(JumpUnlessZero);
+
+      IP += IP->offset;
+      DISPATCH();
     }
-    else if(profile && loopAtIndex.count(IP))
-      ++loopFreq[loopAtIndex[IP]];
 
-    goto *jumpTable[ops[++IP]];
-  } 
-LabJumpUnlessZero: {
-    if(profile)
-      ++instrFreq[JumpUnlessZero];
+    profiler.countLoopEntry(static_cast<size_t>(IP - start));
 
-    if(tape[index] != 0) {
-      IP = matchingLoopBracket[IP];
-      goto *jumpTable[ops[IP]];
+    NEXT();
+  } 
+CHECKED_HANDLER(JumpUnlessZero, IP->cellOffset)
+HANDLER(JumpUnlessZero): {
+    profiler.countOp(JumpUnlessZero);
+
+    const unsigned char *const cell = tape + index;
+    if(cell[IP->cellOffset] != 0) {
+      // the back edge skips the [ check, so count it here instead
+      profiler.countOp(JumpIfZero);
+      profiler.countLoopEntry(static_cast<size_t>(IP + IP->offset - 1 - start));
+
+      IP += IP->offset;
+      DISPATCH();
     }
-    goto *jumpTable[ops[++IP]];
+    NEXT();
   } 
-LabEndOfFile:
+HANDLER(EndOfFile):
+  flushOutput();
   return;
+
+  // Optimized instructions only appear when not profiling
+CHECKED_HANDLER(Zero, IP->cellOffset)
+HANDLER(Zero): {
+    unsigned char *const cell = tape + index;
+    cell[IP->cellOffset] = 0;
+    NEXT();
+  }
+CHECKED_HANDLER(Sum, IP->offset)
+HANDLER(Sum): {
+    unsigned char *const cell = tape + index;
+    cell[IP->offset] += IP->amount;
+    NEXT();
+  }
+CHECKED_HANDLER(MulAdd, min<int32_t>(IP->offset, IP->cellOffset))
+HANDLER(MulAdd): {
+    unsigned char *const cell = tape + index;
+    cell[IP->offset] += static_cast<unsigned char>(cell[IP->cellOffset] * IP->amount);
+    NEXT();
+  }
+HANDLER(AddMemPtr): {
+    index += static_cast<size_t>(IP->offset);
+    CHECK_LOW_REACH();
+    NEXT();
+  }
+HANDLER(MemScan): {
+    const unsigned char *const cell = scanForZero(tape + index + IP->cellOffset, IP->offset);
+    index = static_cast<size_t>(cell - IP->cellOffset - tape);
+    CHECK_LOW_REACH();
+    NEXT();
+  }
+#ifndef BF_DIRECT_THREADED
+  default:
+    cerr << "Invalid bytecode " << static_cast<int>(IP->op) << endl;
+    exit(-1);
+  }
+#endif
 }
 
 int main(int argc, char** argv) {
@@ -240,46 +662,40 @@ int main(int argc, char** argv) {
     profile = true;
 
 
-  const vector<Op> ops = readFile(argv[argc - 1]);
-
-  interpret(ops);
-
-  if(profile) {
-    cout << "\n\n=====PROFILING=====\n";
-    vector<pair<char, size_t>> instrFreqVec;
-    for(size_t instrType = 0; instrType < EndOfFile; ++instrType) {
-      instrFreqVec.push_back({enumToChar[instrType], instrFreq[instrType]});
-    }
-
-    sort(instrFreqVec.begin(), instrFreqVec.end(), [&](auto a, auto b){return a.second > b.second;});
-
-    for(const auto& [op, freq] : instrFreqVec) {
-      cout << op << " : " << freq << "\n";
-    }
-
-    // now onto loops
-
-    vector<pair<string, size_t>> simpleLoopFreq, complexLoopFreq;
+  const vector<OpRun> ops = readFile(argv[argc - 1]);
 
-    for(const auto& [loop, freq] : loopFreq) {
-      if(isSimpleLoop[loop])
-        simpleLoopFreq.push_back({loop, freq});
-      else
-        complexLoopFreq.push_back({loop, freq});
-    }
-
-    sort(simpleLoopFreq.begin(), simpleLoopFreq.end(), [&](auto a, auto b){return a.second > b.second;});
-    sort(complexLoopFreq.begin(), complexLoopFreq.end(), [&](auto a, auto b){return a.second > b.second;});
+  if(!checkValidInstrs(ops)) {
+    cerr << "Loop brackets do not match, aborting." << endl;
+    exit(-1);
+  }
 
-    cout << "\n===Simple Loops===\n";
-    for(const auto& [loop, freq] : simpleLoopFreq) {
-      cout << loop << " : " << freq << "\n";
-    }
+  // Fold runs while parsing and run the compiler's loop simplification, dead
+  // code elimination, inst combine and offset propagation passes, except when
+  // profiling, which reports counts of the source-level ops
+  OptSettings settings;
+  settings.foldRuns = !profile;
+  settings.vectorizeMemScans = !profile;
+  settings.simplifySimpleLoops = !profile;
+  settings.runInstCombine = !profile;
+  settings.propagateOffsets = !profile;
+  settings.eliminateDeadCode = !profile;
+  settings.coalesceWrites = false;
+
+  vector<Instr> instrs = parse(ops, settings);
+  // partialEval and coalesceWrites stay off, so there are no Prints and their outputs stay empty
+  vector<string> outputs;
+  instrs = optimize(std::move(instrs), settings, outputs);
+
+  vector<Bytecode> code = lowerToBytecode(instrs);
+  resolveLoopJumps(code);
 
-    cout << "\n===Complex Loops===\n";
-    for(const auto& [loop, freq] : complexLoopFreq) {
-      cout << loop << " : " << freq << "\n";
-    }
+  if(profile) {
+    Profiler profiler(code);
+    interpret(code, profiler);
+    profiler.report(code);
+  }
+  else {
+    NoProfiler profiler;
+    interpret(code, profiler);
   }
 }
-
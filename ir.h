@@ -0,0 +1,1541 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Shared front end for the compiler and the interpreter: the BF IR,
+// the parser and the optimization passes that run over it.
+
+// What Read stores once input runs out
+enum class EofBehavior : uint8_t {
+  Unchanged,
+  Zero,
+  MinusOne,
+};
+
+struct OptSettings {
+  bool foldRuns {true};
+  bool simplifySimpleLoops {true};
+  bool vectorizeMemScans {false};
+  bool runInstCombine {true};
+  bool partialEval {false};
+  // most instructions partialEval runs inside loops, before it emits the
+  // outermost loop it is running as is instead
+  size_t partialEvalBudget {size_t{1} << 24};
+  bool propagateOffsets {true};
+  bool eliminateDeadCode {true};
+  bool coalesceWrites {true};
+  EofBehavior eof {EofBehavior::MinusOne};
+};
+
+enum Op : uint8_t {
+  MoveRight,
+  MoveLeft,
+  Inc,
+  Dec,
+  Write,
+  Read,
+  JumpIfZero,
+  JumpUnlessZero,
+  EndOfFile,
+  Zero,
+  Sum,
+  MulAdd,
+  AddMemPtr,
+  MemScan,
+  Print
+};
+
+/**
+ * @brief One instruction of the IR. Programs are contiguous vectors of these,
+ *        so the fields each op uses are:
+ *        Sum:       adds amount to the cell at offset
+ *        MulAdd:    adds (posInc ? -cell : cell) * amount to the cell at offset,
+ *                   where cell is the one at srcOffset
+ *        AddMemPtr: adds amount to the tape pointer
+ *        MemScan:   amount is the stride, the scan starts at offset
+ *        [ and ]:   loopId, shared by both brackets of a loop, and compare the cell at offset
+ *        Print:     writes the amount bytes of string stringId of the program's constant output
+ *        Offsets are relative to the tape pointer. Zero, Write and Read act on the cell at offset.
+ */
+struct Instr {
+  Op op;
+  bool posInc;
+  int32_t amount;
+  int32_t offset;
+  union {
+    uint32_t loopId;
+    int32_t srcOffset;
+    uint32_t stringId;
+  };
+};
+
+inline Instr makeInstr(const Op op) {
+  return {op, false, 0, 0, 0};
+}
+
+inline Instr makeJumpInstr(const Op op, const uint32_t loopId) {
+  return {op, false, 0, 0, loopId};
+}
+
+// Cells are bytes, so the amount is kept wrapped to -128..127
+inline Instr makeSumInstr(const int64_t amount, const int64_t offset) {
+  return {Sum, false, static_cast<int8_t>(amount), static_cast<int32_t>(offset), 0};
+}
+
+inline Instr makeMulAddInstr(const int64_t amount, const int64_t offset, const bool posInc) {
+  return {MulAdd, posInc, static_cast<int32_t>(amount), static_cast<int32_t>(offset), 0};
+}
+
+inline Instr makeAddMemPtrInstr(const int64_t amount) {
+  return {AddMemPtr, false, static_cast<int32_t>(amount), 0, 0};
+}
+
+inline Instr makePrintInstr(const uint32_t stringId, const size_t length) {
+  return {Print, false, static_cast<int32_t>(length), 0, stringId};
+}
+
+// Any stride works, as long as its magnitude fits the 32 bit amount
+inline constexpr bool validMemScanStride(const int64_t stride) {
+  return stride != 0 && stride >= -INT32_MAX && stride <= INT32_MAX;
+}
+
+inline Instr makeMemScanInstr(const int64_t stride) {
+  if(!validMemScanStride(stride))
+    throw invalid_argument("Memscan stride of " + to_string(stride) + " is not supported");
+
+  return {MemScan, false, static_cast<int32_t>(stride), 0, 0};
+}
+
+// Labels of the [ and ] of a loop are numbered 2 * loopId and 2 * loopId + 1,
+// and only turned into strings when the program is emitted
+inline size_t labelIndex(const uint32_t loopId, const Op bracket) {
+  return 2 * static_cast<size_t>(loopId) + (bracket == JumpUnlessZero);
+}
+
+inline string loopLabel(const uint32_t loopId, const Op bracket) {
+  return "label" + to_string(labelIndex(loopId, bracket));
+}
+
+inline constexpr array<char, EndOfFile> enumToChar{{'>', '<', '+', '-', '.', ',', '[', ']'}};
+
+// A run of the same op in the source, so +++++ is {Inc, 5}. Only
+// +, -, > and < are merged, every other op has a count of 1.
+struct OpRun {
+  Op op;
+  uint32_t count;
+};
+
+inline constexpr array<int8_t, 256> makeCharToOp() {
+  array<int8_t, 256> table{};
+  for(auto& entry : table)
+    entry = -1;
+
+  for(size_t op = 0; op < EndOfFile; ++op)
+    table[static_cast<unsigned char>(enumToChar[op])] = static_cast<int8_t>(op);
+
+  return table;
+}
+
+// op of each source byte, -1 for comments
+inline constexpr array<int8_t, 256> charToOp = makeCharToOp();
+
+inline void appendOp(vector<OpRun>& runs, const char c) {
+  const int8_t opIndex = charToOp[static_cast<unsigned char>(c)];
+  if(opIndex < 0)
+    return;
+
+  const Op op = static_cast<Op>(opIndex);
+  // MoveRight, MoveLeft, Inc and Dec are the first four ops
+  if(!runs.empty() && runs.back().op == op && op <= Dec)
+    ++runs.back().count;
+  else
+    runs.push_back({op, 1});
+}
+
+#ifdef __SSE2__
+// Bitmask of the bytes among the 16 at data that are BF ops
+inline uint32_t opByteMask(const char* data) {
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+
+  // + , - . are the contiguous range 0x2b to 0x2e
+  const __m128i fromPlus = _mm_sub_epi8(bytes, _mm_set1_epi8('+'));
+  __m128i isOp = _mm_cmpeq_epi8(_mm_min_epu8(fromPlus, _mm_set1_epi8(3)), fromPlus);
+  isOp = _mm_or_si128(isOp, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('<')));
+  isOp = _mm_or_si128(isOp, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('>')));
+  isOp = _mm_or_si128(isOp, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('[')));
+  isOp = _mm_or_si128(isOp, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(']')));
+
+  return static_cast<uint32_t>(_mm_movemask_epi8(isOp));
+}
+#endif
+
+// Classifies data 16 bytes at a time, so comment bytes are skipped in bulk
+// and runs are counted as they are found
+inline void appendOps(vector<OpRun>& runs, const char* data, const size_t size) {
+  size_t pos = 0;
+
+#ifdef __SSE2__
+  for(; pos + 16 <= size; pos += 16) {
+    uint32_t mask = opByteMask(data + pos);
+
+    if(mask == 0xffff) {
+      for(size_t i = pos; i < pos + 16; ++i)
+        appendOp(runs, data[i]);
+      continue;
+    }
+
+    while(mask) {
+      appendOp(runs, data[pos + static_cast<size_t>(__builtin_ctz(mask))]);
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for(; pos < size; ++pos)
+    appendOp(runs, data[pos]);
+}
+
+// mmaps a regular file. Pipes, terminals and the like have no size up
+// front, so they are read into a buffer until end of file instead.
+inline vector<OpRun> readFile(string fileName) {
+  const int fd = open(fileName.c_str(), O_RDONLY);
+  struct stat fileStat;
+
+  if(fd < 0 || fstat(fd, &fileStat) != 0) {
+    cerr << "Unable to open file " << fileName << endl;
+    exit(-1);
+  }
+
+  vector<OpRun> retVec;
+
+  if(!S_ISREG(fileStat.st_mode)) {
+    vector<char> buffer(1 << 16);
+    size_t size = 0;
+    for(;;) {
+      if(size == buffer.size())
+        buffer.resize(2 * size);
+      const ssize_t bytesRead = read(fd, buffer.data() + size, buffer.size() - size);
+      if(bytesRead < 0 && errno == EINTR)
+        continue;
+      if(bytesRead < 0) {
+        cerr << "Unable to read file " << fileName << endl;
+        exit(-1);
+      }
+      if(bytesRead == 0)
+        break;
+      size += static_cast<size_t>(bytesRead);
+    }
+    appendOps(retVec, buffer.data(), size);
+  }
+  else if(fileStat.st_size != 0) {
+    const size_t fileSize = static_cast<size_t>(fileStat.st_size);
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED) {
+      cerr << "Unable to open file " << fileName << endl;
+      exit(-1);
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+    appendOps(retVec, static_cast<const char*>(mapping), fileSize);
+
+    munmap(mapping, fileSize);
+  }
+
+  close(fd);
+
+  retVec.push_back({EndOfFile, 1});
+
+  return retVec;
+}
+
+// Net pointer movement of >, < and AddMemPtr
+inline int64_t pointerDelta(const Instr& instr) {
+  if(instr.op == MoveRight)
+    return 1;
+  if(instr.op == MoveLeft)
+    return -1;
+  return instr.op == AddMemPtr ? instr.amount : 0;
+}
+
+// Amount +, - and Sum add to the cell at instr.offset
+inline int64_t cellDelta(const Instr& instr) {
+  if(instr.op == Inc)
+    return 1;
+  if(instr.op == Dec)
+    return -1;
+  return instr.op == Sum ? instr.amount : 0;
+}
+
+// Adds delta to the AddMemPtr or offset 0 Sum at the back of instrs, or appends
+// a new one. Instructions that net out to nothing are dropped.
+inline void foldIntoBack(vector<Instr>& instrs, const Op op, const int64_t delta) {
+  if(!instrs.empty() && instrs.back().op == op && instrs.back().offset == 0) {
+    const int64_t amount = instrs.back().amount + delta;
+    instrs.back() = (op == Sum) ? makeSumInstr(amount, 0) : makeAddMemPtrInstr(amount);
+  }
+  else
+    instrs.push_back((op == Sum) ? makeSumInstr(delta, 0) : makeAddMemPtrInstr(delta));
+
+  if(instrs.back().amount == 0)
+    instrs.pop_back();
+}
+
+// With settings.foldRuns, runs of + and - become one Sum and runs of > and <
+// one AddMemPtr of their net amount, so +++--- disappears entirely.
+// Otherwise every source op is its own instruction.
+inline vector<Instr> parse(const vector<OpRun>& ops, const OptSettings& settings) {
+  // Note: %rdi will hold the current index on the tape
+  // Except when calling putchar or getchar, then %rdi
+  // will be pushed onto the stack
+
+  vector<Instr> instructions;
+  size_t instrCount = ops.size();
+  if(!settings.foldRuns) {
+    instrCount = 0;
+    for(const auto& [op, count] : ops)
+      instrCount += count;
+  }
+  instructions.reserve(instrCount);
+
+  // loops are numbered in the order they close, the [ gets its id from the ]
+  stack<size_t> leftBrackLocs;
+  uint32_t loopCounter = 0;
+
+  for(const auto& [op, count] : ops) {
+    switch(op) {
+      case MoveRight:
+      case MoveLeft:
+      case Inc:
+      case Dec: {
+        if(!settings.foldRuns) {
+          instructions.insert(instructions.end(), count, makeInstr(op));
+          break;
+        }
+
+        const int64_t delta = (op == MoveRight || op == Inc) ? count : -static_cast<int64_t>(count);
+        foldIntoBack(instructions, (op == Inc || op == Dec) ? Sum : AddMemPtr, delta);
+        break;
+      }
+      case JumpIfZero: {
+        leftBrackLocs.push(instructions.size());
+        instructions.push_back(makeJumpInstr(JumpIfZero, 0));
+        break;
+      }
+      case JumpUnlessZero: {
+        instructions[leftBrackLocs.top()].loopId = loopCounter;
+        leftBrackLocs.pop();
+        instructions.push_back(makeJumpInstr(JumpUnlessZero, loopCounter++));
+        break;
+      }
+      default: {
+        instructions.push_back(makeInstr(op));
+        break;
+      }
+    }
+  }
+
+  return instructions;
+}
+
+// Multiplicative inverse of an odd value mod 256, by Newton's iteration
+inline uint8_t inverseMod256(const uint8_t odd) {
+  uint32_t inverse = odd; // correct to 3 bits, each step doubles that
+  for(int i = 0; i < 3; ++i)
+    inverse *= 2 - odd * inverse;
+  return static_cast<uint8_t>(inverse);
+}
+
+/**
+ * @brief A loop stepping its induction cell by step runs the n times where
+ *        cell + n * step = 0 mod 256. Writing -step as 2^k * u with u odd,
+ *        2^k * n = cell * inverse(u) mod 256, so a cell that gains amount per
+ *        iteration gains cell * (amount / 2^k) * inverse(u) in total. Returns
+ *        that factor, or nothing if amount is not a multiple of 2^k.
+ */
+inline optional<uint8_t> tripCountFactor(const uint8_t step, const uint8_t amount) {
+  const uint8_t negStep = static_cast<uint8_t>(-step);
+  const int k = __builtin_ctz(negStep);
+
+  if(amount & ((1 << k) - 1))
+    return {};
+
+  return static_cast<uint8_t>((amount >> k) * inverseMod256(static_cast<uint8_t>(negStep >> k)));
+}
+
+// Generates only instructions inside the loop, not loops brackets, unless
+// the step is even. Then the loop never ends if the induction cell is not a
+// multiple of 2^k, so the cell is multiplied by 2^(8 - k), which is zero
+// exactly when it is, and an empty loop with the same brackets hangs otherwise.
+inline optional<vector<Instr>> generateSimplifiedLoopInstrs(const unordered_map<int64_t,int64_t>& incrementAtOffset,
+                                                            const vector<Instr>& instrs, const size_t begin, const size_t end) {
+  vector<Instr> newInstrs;
+
+  const uint8_t inducInc = static_cast<uint8_t>(incrementAtOffset.at(0));
+
+  for(const auto& [offset, amount] : incrementAtOffset) {
+    if(offset == 0)
+      continue;
+    const auto factor = tripCountFactor(inducInc, static_cast<uint8_t>(amount));
+    if(!factor)
+      return {};
+    if(factor.value() != 0)
+      newInstrs.push_back(makeMulAddInstr(static_cast<int8_t>(factor.value()), offset, false));
+  }
+
+  if(inducInc & 1) {
+    newInstrs.push_back(makeInstr(Zero));
+    return newInstrs;
+  }
+
+  const int k = __builtin_ctz(inducInc);
+  newInstrs.push_back(makeMulAddInstr(static_cast<int8_t>((1 << (8 - k)) - 1), 0, false));
+  newInstrs.push_back(instrs[begin]);
+  newInstrs.push_back(instrs[end - 1]);
+
+  return newInstrs;
+}
+
+// Generates loop brackets as well
+inline vector<Instr> generateMemScanInstructions(const vector<Instr>& instrs, const size_t begin, const size_t end, const int64_t stride) {
+  vector<Instr> newInstrs;
+
+  newInstrs.push_back(instrs[begin]);
+  newInstrs.push_back(makeMemScanInstr(stride));
+  newInstrs.push_back(instrs[end - 1]);
+
+  return newInstrs;
+}
+
+// Value of a cell while simulating one iteration of a loop body: its value at
+// the start of the iteration plus value, the constant value, or unknown
+struct CellValue {
+  enum Kind : uint8_t { Relative, Constant, Unknown };
+  Kind kind {Relative};
+  uint8_t value {0};
+};
+
+// Index of the ] matching the [ at open
+inline size_t matchingClose(const vector<Instr>& instrs, size_t open) {
+  for(size_t depth = 0;; ++open) {
+    if(instrs[open].op == JumpIfZero)
+      ++depth;
+    else if(instrs[open].op == JumpUnlessZero && --depth == 0)
+      return open;
+  }
+}
+
+/**
+ * @brief Simulates [begin, end) from cells, with the pointer at pos. A nested loop is taken to
+ *        run at most once, which holds when a pass through its body leaves the cell it tests
+ *        zero, as it does for peeled loops. It is skipped or run depending on the cell it tests.
+ *        When that cell is not a constant both are simulated, the cells they disagree on become
+ *        Unknown, and the tested cell is zero either way. Returns false if the region does I/O,
+ *        scans memory or has a loop that can run more than once.
+ */
+inline bool simulateRegion(const vector<Instr>& instrs, const size_t begin, const size_t end,
+                           unordered_map<int64_t, CellValue>& cells, int64_t& pos) {
+  for(size_t i = begin; i < end; ++i) {
+    const Instr& instr = instrs[i];
+    switch(instr.op) {
+      case MoveRight:
+      case MoveLeft:
+      case AddMemPtr:
+        pos += pointerDelta(instr);
+        break;
+      case Inc:
+      case Dec:
+      case Sum: {
+        CellValue& cell = cells[pos + instr.offset];
+        cell.value = static_cast<uint8_t>(cell.value + cellDelta(instr));
+        break;
+      }
+      case Zero:
+        cells[pos] = {CellValue::Constant, 0};
+        break;
+      case MulAdd: {
+        const CellValue source = cells[pos];
+        CellValue& target = cells[pos + instr.offset];
+        const int64_t factor = instr.posInc ? -instr.amount : instr.amount;
+
+        if(source.kind == CellValue::Constant)
+          target.value = static_cast<uint8_t>(target.value + factor * source.value);
+        else
+          target.kind = CellValue::Unknown;
+        break;
+      }
+      case JumpIfZero: {
+        const size_t close = matchingClose(instrs, i);
+        const int64_t tested = pos + instr.offset;
+        const CellValue condition = cells[tested];
+
+        if(condition.kind != CellValue::Constant || condition.value != 0) {
+          auto taken = cells;
+          int64_t takenPos = pos;
+          if(!simulateRegion(instrs, i + 1, close, taken, takenPos) || takenPos != pos)
+            return false;
+
+          const CellValue exit = taken[tested];
+          if(exit.kind != CellValue::Constant || exit.value != 0)
+            return false;
+
+          if(condition.kind != CellValue::Constant) {
+            for(auto& [offset, cell] : taken) {
+              const auto skipped = cells.find(offset);
+              const CellValue other = (skipped == cells.end()) ? CellValue{} : skipped->second;
+              if(other.kind != cell.kind || other.value != cell.value)
+                cell = {CellValue::Unknown, 0};
+            }
+            taken[tested] = {CellValue::Constant, 0};
+          }
+          cells = std::move(taken);
+        }
+
+        i = close;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+// Simulates one iteration of a loop body, starting from cells, where missing
+// cells are Relative. Returns nothing if simulateRegion fails or if the
+// pointer does not end where it started.
+inline optional<unordered_map<int64_t, CellValue>> simulateLoopBody(const vector<Instr>& instrs, const size_t begin, const size_t end,
+                                                                    unordered_map<int64_t, CellValue> cells) {
+  int64_t pos = 0;
+  if(!simulateRegion(instrs, begin, end, cells, pos) || pos != 0)
+    return {};
+
+  return cells;
+}
+
+// Most instructions in a loop body that gets a second iteration peeled, since
+// peeling doubles the body and nested loops can each be peeled
+constexpr size_t MAX_TWICE_PEELED_BODY = 256;
+
+// Appends instrs in [begin, end), renumbering its loops from nextLoopId
+inline void appendRenumbered(vector<Instr>& newInstrs, const vector<Instr>& instrs, const size_t begin, const size_t end,
+                             uint32_t& nextLoopId) {
+  stack<uint32_t> openLoopIds;
+  for(size_t i = begin; i < end; ++i) {
+    Instr instr = instrs[i];
+    if(instr.op == JumpIfZero) {
+      instr.loopId = nextLoopId++;
+      openLoopIds.push(instr.loopId);
+    }
+    else if(instr.op == JumpUnlessZero) {
+      instr.loopId = openLoopIds.top();
+      openLoopIds.pop();
+    }
+    newInstrs.push_back(instr);
+  }
+}
+
+/**
+ * @brief Simplifies a loop whose body also zeroes or multiply-adds cells, or runs nested loops
+ *        at most once, such as an outer loop whose inner loops were simplified. The first
+ *        iteration is kept as is. After it, the cells the body zeroes have settled to constants,
+ *        so if the induction cell steps by an odd amount and each later iteration adds the same
+ *        amount to every other cell, those iterations are replaced with MulAdds by the remaining
+ *        count. A cell that is only zeroed when a nested loop runs settles one iteration later,
+ *        so small bodies get a second iteration peeled, behind another [ ] on the induction cell.
+ *        The loop then runs at most once. Generates loop brackets as well.
+ */
+inline optional<vector<Instr>> generatePeeledLoopInstrs(const vector<Instr>& instrs, const size_t begin, const size_t end,
+                                                        uint32_t& nextLoopId) {
+  // constants at the start of the iteration after the peeled ones
+  unordered_map<int64_t, CellValue> settled;
+
+  for(size_t peeled = 1; peeled <= 2; ++peeled) {
+    if(peeled == 2 && end - begin - 2 > MAX_TWICE_PEELED_BODY)
+      return {};
+
+    const auto peeledIteration = simulateLoopBody(instrs, begin + 1, end - 1, settled);
+    if(!peeledIteration)
+      return {};
+
+    settled.clear();
+    for(const auto& [offset, cell] : peeledIteration.value()) {
+      if(cell.kind == CellValue::Constant)
+        settled[offset] = cell;
+    }
+
+    const auto laterIteration = simulateLoopBody(instrs, begin + 1, end - 1, settled);
+    if(!laterIteration)
+      return {};
+
+    // the remaining count is only in the induction cell if every later iteration steps it the same
+    const auto laterInduc = laterIteration->find(0);
+    if(laterInduc == laterIteration->end())
+      return {};
+
+    const CellValue inducCell = laterInduc->second;
+    if(inducCell.kind != CellValue::Relative || !(inducCell.value & 1))
+      return {};
+
+    vector<Instr> remaining;
+    bool uniform = true;
+    for(const auto& [offset, cell] : laterIteration.value()) {
+      if(cell.kind == CellValue::Unknown)
+        uniform = false;
+      else if(cell.kind == CellValue::Constant) {
+        const auto settledCell = settled.find(offset);
+        if(settledCell == settled.end() || settledCell->second.value != cell.value)
+          uniform = false;
+      }
+      else if(offset != 0 && cell.value != 0) {
+        const uint8_t factor = tripCountFactor(inducCell.value, cell.value).value();
+        remaining.push_back(makeMulAddInstr(static_cast<int8_t>(factor), offset, false));
+      }
+    }
+    if(!uniform)
+      continue;
+
+    // [ body [ body MulAdds Zero ] ]: each [ ] runs at most once, and the
+    // ones of the second iteration are renumbered
+    vector<Instr> newInstrs(instrs.begin() + static_cast<long>(begin), instrs.begin() + static_cast<long>(end) - 1);
+    vector<Instr> closes{instrs[end - 1]};
+    for(size_t copy = 1; copy < peeled; ++copy) {
+      Instr guard = instrs[begin];
+      guard.loopId = nextLoopId++;
+      newInstrs.push_back(guard);
+      appendRenumbered(newInstrs, instrs, begin + 1, end - 1, nextLoopId);
+
+      guard.op = JumpUnlessZero;
+      closes.push_back(guard);
+    }
+
+    newInstrs.insert(newInstrs.end(), remaining.begin(), remaining.end());
+    newInstrs.push_back(makeInstr(Zero));
+    newInstrs.insert(newInstrs.end(), closes.rbegin(), closes.rend());
+
+    return newInstrs;
+  }
+
+  return {};
+}
+
+inline optional<vector<Instr>> checkSimpleOrMemScanLoop(const vector<Instr>& instrs, const size_t begin, const size_t end, const OptSettings& settings,
+                                                        uint32_t& nextLoopId) {
+  int64_t currMemOffset = 0;
+  unordered_map<int64_t, int64_t> incrementAtOffset;
+
+  for(size_t i = begin; i < end; ++i) {
+    const Instr& instr = instrs.at(i);
+    const Op op = instr.op;
+    if(op == MoveRight || op == MoveLeft || op == AddMemPtr)
+      currMemOffset += pointerDelta(instr);
+    else if(op == Inc || op == Dec || op == Sum)
+      incrementAtOffset[currMemOffset + instr.offset] += cellDelta(instr);
+    else if((op == JumpIfZero || op == JumpUnlessZero) && (i == begin || i == end - 1))
+      continue;
+    else if((op == Zero || op == MulAdd || op == JumpIfZero) && settings.simplifySimpleLoops)
+      return generatePeeledLoopInstrs(instrs, begin, end, nextLoopId);
+    else
+      return {};
+  }
+
+  // Memory scan loops that only move the pointer
+  if(settings.vectorizeMemScans && validMemScanStride(currMemOffset) && incrementAtOffset.empty())
+    return generateMemScanInstructions(instrs, begin, end, currMemOffset);
+
+  if(!settings.simplifySimpleLoops)
+    return {};
+
+  if(!incrementAtOffset.count(0))
+    return {};
+
+  if(static_cast<uint8_t>(incrementAtOffset.at(0)) == 0)
+    return {};
+
+  if(currMemOffset != 0)
+    return {};
+
+  return generateSimplifiedLoopInstrs(incrementAtOffset, instrs, begin, end);
+}
+
+
+// All passes stream their input into a fresh vector in one sweep. A region
+// being rewritten is always at the back of the output, so replacing it is a
+// resize and an append instead of an erase and insert in the middle. Passes
+// take their input by value so it is freed as soon as they return.
+inline vector<Instr> simplifyLoops(vector<Instr> instrs, const OptSettings& settings) {
+  if(!settings.simplifySimpleLoops && !settings.vectorizeMemScans)
+    return instrs;
+
+  vector<Instr> newInstrs;
+  newInstrs.reserve(instrs.size());
+
+  // peeling a second iteration copies loops, which get new ids from here
+  uint32_t nextLoopId = 0;
+  for(const auto& instr : instrs) {
+    if(instr.op == JumpIfZero)
+      nextLoopId = max(nextLoopId, instr.loopId + 1);
+  }
+
+  // [ of every open loop in newInstrs, and whether its body is still free of
+  // branches after simplifying the loops nested in it. Peeled loops keep their
+  // brackets only to guard against a zero count and run at most once, which
+  // the enclosing loop's simulation handles.
+  vector<pair<size_t, bool>> openLoops;
+
+  for(const auto& instr : instrs) {
+    const Op op = instr.op;
+    newInstrs.push_back(instr);
+
+    if(op == JumpIfZero)
+      openLoops.push_back({newInstrs.size() - 1, true});
+    else if(op == JumpUnlessZero) {
+      const auto [lhsIndex, branchFree] = openLoops.back();
+      openLoops.pop_back();
+
+      bool remainsLoop = true;
+      if(branchFree) {
+        auto loopInstr = checkSimpleOrMemScanLoop(newInstrs, lhsIndex, newInstrs.size(), settings, nextLoopId);
+        if(loopInstr) {
+          auto& loopInstrs = loopInstr.value();
+          const Op beforeClose = loopInstrs.size() >= 2 ? loopInstrs[loopInstrs.size() - 2].op : loopInstrs.back().op;
+          const bool peeled = beforeClose == Zero || beforeClose == JumpUnlessZero;
+          remainsLoop = loopInstrs.back().op == JumpUnlessZero && !peeled;
+
+          newInstrs.resize(lhsIndex);
+          newInstrs.insert(newInstrs.end(), loopInstrs.begin(), loopInstrs.end());
+        }
+      }
+
+      if(remainsLoop && !openLoops.empty())
+        openLoops.back().second = false;
+    }
+  }
+  
+  return newInstrs;
+}
+
+/**
+ * @brief Cells holding a known constant while going through a program in order, starting
+ *        from a tape that is all zero. Loop bodies start from nothing known, since they are
+ *        also entered from their ], and a loop or scan exit only knows that the cell it
+ *        tested is zero. Cells are relative to pos, the pointer's net movement so far.
+ */
+struct KnownCells {
+  // nullopt for unknown; cells missing from here are zero until the first
+  // loop or scan, unknown afterwards
+  unordered_map<int64_t, optional<uint8_t>> cells;
+  bool untouchedAreZero {true};
+  int64_t pos {0};
+
+  optional<uint8_t> valueAt(const int64_t cell) const {
+    const auto it = cells.find(cell);
+    if(it != cells.end())
+      return it->second;
+    return untouchedAreZero ? optional<uint8_t>{0} : nullopt;
+  }
+
+  void forgetAll() {
+    cells.clear();
+    untouchedAreZero = false;
+  }
+
+  // Updates the cells for instr being run, which is entered if it is a loop
+  void apply(const Instr& instr) {
+    const int64_t cell = pos + instr.offset;
+
+    switch(instr.op) {
+      case MoveRight:
+      case MoveLeft:
+      case AddMemPtr:
+        pos += pointerDelta(instr);
+        break;
+      case Inc:
+      case Dec:
+      case Sum: {
+        const auto value = valueAt(cell);
+        cells[cell] = value ? optional<uint8_t>{static_cast<uint8_t>(*value + cellDelta(instr))} : nullopt;
+        break;
+      }
+      case MulAdd: {
+        const auto source = valueAt(pos + instr.srcOffset), target = valueAt(cell);
+        if(source && target) {
+          const uint8_t factor = static_cast<uint8_t>(instr.posInc ? -instr.amount : instr.amount);
+          cells[cell] = static_cast<uint8_t>(*target + *source * factor);
+        }
+        else
+          cells[cell] = nullopt;
+        break;
+      }
+      case Zero:
+        cells[cell] = 0;
+        break;
+      case Read:
+        cells[cell] = nullopt;
+        break;
+      case JumpIfZero:
+        forgetAll();
+        break;
+      case MemScan:
+      case JumpUnlessZero:
+        forgetAll();
+        cells[cell] = 0;
+        break;
+      default:
+        break;
+    }
+  }
+};
+
+/**
+ * @brief Drops what cannot have an effect given the KnownCells: loops and memory scans
+ *        starting on a zero cell, MulAdds from a zero cell and Zeros of a zero cell. A Zero
+ *        of any other known constant becomes a Sum, which instCombine can then merge with
+ *        its neighbours. A loop starting on a known nonzero cell is first gone through as if
+ *        its body ran once. If its ] then tests a known zero, it never jumps back, so both
+ *        brackets are dropped, as for peeled loops. Otherwise the loop is gone through again
+ *        as a loop.
+ */
+inline vector<Instr> eliminateDeadCode(vector<Instr> instrs, const OptSettings& settings) {
+  if(!settings.eliminateDeadCode)
+    return instrs;
+
+  vector<Instr> newInstrs;
+  newInstrs.reserve(instrs.size());
+
+  KnownCells known;
+  // depth of the dead loop being skipped, 0 when not in one
+  size_t deadLoopDepth = 0;
+
+  struct OpenLoop {
+    bool runsOnce;
+    // for loops gone through as running once: their [ and what to restore if they do not
+    size_t lhsIndex;
+    size_t emittedSize;
+    KnownCells knownBefore;
+  };
+  vector<OpenLoop> openLoops;
+  // [ of loops that turned out to run more than once
+  vector<bool> isLoop(instrs.size());
+
+  for(size_t i = 0; i < instrs.size(); ++i) {
+    const Instr& instr = instrs[i];
+    const Op op = instr.op;
+
+    if(deadLoopDepth > 0) {
+      if(op == JumpIfZero)
+        ++deadLoopDepth;
+      else if(op == JumpUnlessZero)
+        --deadLoopDepth;
+      continue;
+    }
+
+    const auto value = known.valueAt(known.pos + instr.offset);
+    if(op == MulAdd && known.valueAt(known.pos + instr.srcOffset) == 0)
+      continue;
+    if(op == JumpIfZero && value == 0) {
+      deadLoopDepth = 1;
+      continue;
+    }
+    if(op == JumpIfZero && value && !isLoop[i]) {
+      openLoops.push_back({true, i, newInstrs.size(), known});
+      continue;
+    }
+    if(op == JumpIfZero)
+      openLoops.push_back({false, 0, 0, {}});
+    if(op == JumpUnlessZero) {
+      OpenLoop loop = std::move(openLoops.back());
+      openLoops.pop_back();
+
+      if(loop.runsOnce && value == 0)
+        continue;
+      if(loop.runsOnce) {
+        // a [ on a known nonzero cell comes after the instruction that set it
+        isLoop[loop.lhsIndex] = true;
+        newInstrs.resize(loop.emittedSize);
+        known = std::move(loop.knownBefore);
+        i = loop.lhsIndex - 1;
+        continue;
+      }
+    }
+    if((op == Zero || op == MemScan) && value == 0)
+      continue;
+
+    known.apply(instr);
+    if(op == Zero && value)
+      newInstrs.push_back(makeSumInstr(-int64_t{*value}, instr.offset));
+    else
+      newInstrs.push_back(instr);
+  }
+
+  return newInstrs;
+}
+
+inline vector<Instr> instCombine(vector<Instr> instrs, const OptSettings& settings) {
+  if(!settings.runInstCombine)
+    return instrs;
+
+  vector<Instr> newInstrs;
+  newInstrs.reserve(instrs.size());
+
+  int64_t currMemOffset = 0;
+  unordered_map<int64_t, int64_t> incrementAtOffset;
+
+  // start of the current run of >, <, +, -, Sum and AddMemPtr in newInstrs
+  size_t lhs = 0;
+  for(const auto& instr : instrs) {
+    const Op op = instr.op;
+    if(op == MoveRight || op == MoveLeft || op == AddMemPtr)
+      currMemOffset += pointerDelta(instr);
+    else if(op == Inc || op == Dec || op == Sum)
+      incrementAtOffset[currMemOffset + instr.offset] += cellDelta(instr);
+    else {
+      if(newInstrs.size() >= lhs + 2) { // >[>.
+        newInstrs.resize(lhs);
+
+        for(const auto& [offset, amount] : incrementAtOffset) {
+          if(static_cast<int8_t>(amount) != 0)
+            newInstrs.push_back(makeSumInstr(amount, offset));
+        }
+
+        if(currMemOffset != 0)
+          newInstrs.push_back(makeAddMemPtrInstr(currMemOffset));
+      }
+
+      newInstrs.push_back(instr);
+      lhs = newInstrs.size();
+      incrementAtOffset.clear();
+      currMemOffset = 0;
+      continue;
+    }
+
+    newInstrs.push_back(instr);
+  }
+
+  return newInstrs;
+}
+
+inline unordered_map<size_t, size_t> initializeLoopBracketIndexes(const vector<Instr>& instrs) {
+  unordered_map<size_t, size_t> matchingIndex;
+  stack<size_t> leftBrackLocs;
+
+  for(size_t i = 0; i < instrs.size(); ++i) {
+    if(instrs[i].op == JumpIfZero)
+      leftBrackLocs.push(i);
+    else if(instrs[i].op == JumpUnlessZero) {
+      const size_t indexOfTarget = leftBrackLocs.top();
+      leftBrackLocs.pop();
+
+      matchingIndex[i] = indexOfTarget;
+      matchingIndex[indexOfTarget] = i;
+    }
+  }
+
+  return matchingIndex;
+}
+
+// Cell of the abstract tape partialEval runs on: its value, and what the
+// emitted program's tape holds there, nullopt where either depends on input
+struct PartialEvalCell {
+  optional<uint8_t> value {0};
+  optional<uint8_t> tapeValue {0};
+};
+
+// Cells a loop touches and writes, relative to the pointer at its [
+struct LoopEffects {
+  unordered_set<int64_t> touched;
+  unordered_set<int64_t> written;
+};
+
+// Returns nothing if the loop at [begin, end), or any loop nested in it, moves
+// the pointer on net or scans memory, since the cells it touches are unbounded
+inline optional<LoopEffects> boundLoopEffects(const vector<Instr>& instrs, const size_t begin, const size_t end) {
+  LoopEffects effects;
+  int64_t pos = 0;
+  stack<int64_t> loopHeadPositions;
+
+  const auto write = [&](const int64_t cell) {
+    effects.touched.insert(cell);
+    effects.written.insert(cell);
+  };
+
+  for(size_t i = begin; i < end; ++i) {
+    const Instr& instr = instrs[i];
+    const int64_t cell = pos + instr.offset;
+
+    switch(instr.op) {
+      case MoveRight:
+      case MoveLeft:
+      case AddMemPtr:
+        pos += pointerDelta(instr);
+        break;
+      case Inc:
+      case Dec:
+      case Sum:
+      case Zero:
+      case Read:
+        write(cell);
+        break;
+      case MulAdd:
+        effects.touched.insert(pos + instr.srcOffset);
+        write(cell);
+        break;
+      case Write:
+        effects.touched.insert(cell);
+        break;
+      case JumpIfZero:
+        effects.touched.insert(cell);
+        loopHeadPositions.push(pos);
+        break;
+      case JumpUnlessZero:
+        effects.touched.insert(cell);
+        if(pos != loopHeadPositions.top())
+          return nullopt;
+        loopHeadPositions.pop();
+        break;
+      default:
+        return nullopt;
+    }
+  }
+
+  return effects;
+}
+
+/**
+ * @brief Runs the program at compile time on an abstract tape, where cells written by Read
+ *        are unknown, and emits only what depends on them, storing known cells to the tape
+ *        just before emitted code uses them. Loops on a known cell are run. A loop on an
+ *        unknown cell is emitted as is, and when it leaves the pointer where it found it,
+ *        evaluation goes on with only the cells it writes unknown and its test cell zero.
+ *        When a loop being run hits an unbounded input-dependent loop, a memory scan over
+ *        unknown cells or the step budget, it is rolled back and handled the same way.
+ *        Anything else ends evaluation: every known cell is stored, and the rest of the
+ *        program is emitted as is. Known output is collected into outputs and printed
+ *        with one Print right before the next emitted instruction that does I/O, so a
+ *        program without input becomes a single Print.
+ */
+inline vector<Instr> partialEval(vector<Instr> instrs, const OptSettings& settings, vector<string>& outputs) {
+  if(!settings.partialEval)
+    return instrs;
+
+  const unordered_map<size_t, size_t> matchingLoopBracket = initializeLoopBracketIndexes(instrs);
+
+  vector<Instr> newInstrs;
+  // cells missing from here are zero, both in value and on the tape
+  unordered_map<int64_t, PartialEvalCell> cells;
+  // abstract pointer, and where the emitted program's pointer is
+  int64_t pos = 0, emittedPos = 0;
+  // emitted loops are renumbered, since a loop can be emitted more than once
+  uint32_t nextLoopId = 0;
+  // known output not printed yet
+  string pendingOutput;
+
+  const auto valueAt = [&](const int64_t cell) -> optional<uint8_t> {
+    const auto it = cells.find(cell);
+    return (it == cells.end()) ? optional<uint8_t>{0} : it->second.value;
+  };
+
+  const auto movePointerTo = [&](const int64_t target) {
+    if(emittedPos != target)
+      newInstrs.push_back(makeAddMemPtrInstr(target - emittedPos));
+    emittedPos = target;
+  };
+
+  const auto materialize = [&](const int64_t cell) {
+    const auto it = cells.find(cell);
+    if(it == cells.end() || !it->second.value || it->second.tapeValue == it->second.value)
+      return;
+
+    auto& [value, tapeValue] = it->second;
+    movePointerTo(cell);
+    if(!tapeValue)
+      newInstrs.push_back(makeInstr(Zero));
+    if(*value != tapeValue.value_or(0))
+      newInstrs.push_back(makeSumInstr(*value - tapeValue.value_or(0), 0));
+    tapeValue = value;
+  };
+
+  const auto materializeAll = [&](vector<int64_t> offsets) {
+    sort(offsets.begin(), offsets.end());
+    for(const int64_t offset : offsets)
+      materialize(offset);
+  };
+
+  const auto flushOutput = [&]() {
+    if(pendingOutput.empty())
+      return;
+    newInstrs.push_back(makePrintInstr(static_cast<uint32_t>(outputs.size()), pendingOutput.size()));
+    outputs.push_back(std::move(pendingOutput));
+    pendingOutput.clear();
+  };
+
+  const auto appendRegion = [&](const size_t begin, const size_t end) {
+    stack<uint32_t> openLoopIds;
+    for(size_t i = begin; i < end; ++i) {
+      Instr instr = instrs[i];
+      if(instr.op == JumpIfZero) {
+        instr.loopId = nextLoopId++;
+        openLoopIds.push(instr.loopId);
+      }
+      else if(instr.op == JumpUnlessZero) {
+        instr.loopId = openLoopIds.top();
+        openLoopIds.pop();
+      }
+      newInstrs.push_back(instr);
+    }
+  };
+
+  size_t steps = 0;
+
+  // Emits the loop at [begin, end) as is, if the cells it touches are bounded
+  const auto emitResidualLoop = [&](const size_t begin, const size_t end) {
+    const auto effects = boundLoopEffects(instrs, begin, end);
+    if(!effects)
+      return false;
+
+    vector<int64_t> touched;
+    for(const int64_t cell : effects->touched)
+      touched.push_back(pos + cell);
+    materializeAll(std::move(touched));
+
+    flushOutput();
+    movePointerTo(pos);
+    appendRegion(begin, end);
+    steps += end - begin;
+
+    for(const int64_t cell : effects->written)
+      cells[pos + cell] = {nullopt, nullopt};
+    cells[pos + instrs[end - 1].offset] = {0, 0};
+    return true;
+  };
+
+  // Stores every known cell and emits the rest of the program from begin as is
+  const auto giveUp = [&](const size_t begin) {
+    vector<int64_t> offsets;
+    for(const auto& [offset, cell] : cells)
+      offsets.push_back(offset);
+    materializeAll(std::move(offsets));
+
+    flushOutput();
+    movePointerTo(pos);
+    appendRegion(begin, instrs.size());
+    return instrs.size();
+  };
+
+  // state at the [ of the outermost loop being run
+  struct Checkpoint {
+    unordered_map<int64_t, PartialEvalCell> cells;
+    int64_t pos, emittedPos;
+    size_t emittedSize;
+    uint32_t nextLoopId;
+    string pendingOutput;
+    size_t outputsSize;
+    size_t lhs;
+  };
+  optional<Checkpoint> checkpoint;
+  size_t runningLoops = 0;
+
+  // Rolls back the outermost loop being run and emits it as is instead, or
+  // gives up at IP when not running a loop. Returns where to continue.
+  const auto abandon = [&](const size_t IP) {
+    if(!checkpoint)
+      return giveUp(IP);
+
+    cells = std::move(checkpoint->cells);
+    pos = checkpoint->pos;
+    emittedPos = checkpoint->emittedPos;
+    newInstrs.resize(checkpoint->emittedSize);
+    nextLoopId = checkpoint->nextLoopId;
+    pendingOutput = std::move(checkpoint->pendingOutput);
+    outputs.resize(checkpoint->outputsSize);
+
+    const size_t lhs = checkpoint->lhs, rhs = matchingLoopBracket.at(lhs);
+    checkpoint.reset();
+    runningLoops = 0;
+
+    return emitResidualLoop(lhs, rhs + 1) ? rhs + 1 : giveUp(lhs);
+  };
+
+  size_t IP = 0;
+  while(IP < instrs.size()) {
+    const Instr& instr = instrs[IP];
+    const int64_t cellOffset = pos + instr.offset;
+
+    if(runningLoops > 0 && ++steps > settings.partialEvalBudget) {
+      IP = abandon(IP);
+      continue;
+    }
+
+    switch(instr.op) {
+      case MoveRight:
+      case MoveLeft:
+      case AddMemPtr:
+        pos += pointerDelta(instr);
+        break;
+      case Inc:
+      case Dec:
+      case Sum: {
+        auto& value = cells[cellOffset].value;
+        if(value)
+          value = static_cast<uint8_t>(*value + cellDelta(instr));
+        else {
+          movePointerTo(pos);
+          newInstrs.push_back(makeSumInstr(cellDelta(instr), instr.offset));
+        }
+        break;
+      }
+      case Zero:
+        cells[cellOffset].value = 0;
+        break;
+      case MulAdd: {
+        const auto source = valueAt(pos + instr.srcOffset);
+        const uint8_t factor = static_cast<uint8_t>(instr.posInc ? -instr.amount : instr.amount);
+
+        if(!source) {
+          materialize(cellOffset);
+          movePointerTo(pos);
+          newInstrs.push_back(instr);
+          cells[cellOffset] = {nullopt, nullopt};
+          break;
+        }
+
+        auto& target = cells[cellOffset].value;
+        if(target)
+          target = static_cast<uint8_t>(*target + *source * factor);
+        else if(static_cast<uint8_t>(*source * factor) != 0) {
+          movePointerTo(pos);
+          newInstrs.push_back(makeSumInstr(*source * factor, instr.offset));
+        }
+        break;
+      }
+      case Write: {
+        const auto value = valueAt(cellOffset);
+        if(value) {
+          pendingOutput += static_cast<char>(*value);
+          break;
+        }
+        flushOutput();
+        movePointerTo(pos);
+        newInstrs.push_back(instr);
+        break;
+      }
+      case Read:
+        // at end of input the cell may keep its value, so it has to be on the tape
+        if(settings.eof == EofBehavior::Unchanged)
+          materialize(cellOffset);
+        flushOutput();
+        movePointerTo(pos);
+        newInstrs.push_back(instr);
+        cells[cellOffset] = {nullopt, nullopt};
+        break;
+      case MemScan: {
+        int64_t scanned = cellOffset;
+        optional<uint8_t> value;
+        while((value = valueAt(scanned)) && *value != 0)
+          scanned += instr.amount;
+
+        if(!value) {
+          IP = abandon(IP);
+          continue;
+        }
+        pos = scanned - instr.offset;
+        break;
+      }
+      case JumpIfZero: {
+        const auto value = valueAt(cellOffset);
+        const size_t rhs = matchingLoopBracket.at(IP);
+        if(value == 0) {
+          IP = rhs + 1;
+          continue;
+        }
+
+        if(!value || steps > settings.partialEvalBudget) {
+          IP = emitResidualLoop(IP, rhs + 1) ? rhs + 1 : abandon(IP);
+          continue;
+        }
+
+        if(runningLoops++ == 0)
+          checkpoint = Checkpoint{cells, pos, emittedPos, newInstrs.size(), nextLoopId, pendingOutput, outputs.size(), IP};
+        break;
+      }
+      case JumpUnlessZero: {
+        const auto value = valueAt(cellOffset);
+        const size_t lhs = matchingLoopBracket.at(IP);
+        if(value && value != 0) {
+          IP = lhs + 1;
+          continue;
+        }
+
+        // once the test depends on input, the iterations left become a loop
+        if(!value && !emitResidualLoop(lhs, IP + 1)) {
+          IP = abandon(IP);
+          continue;
+        }
+
+        if(--runningLoops == 0)
+          checkpoint.reset();
+        break;
+      }
+      case EndOfFile:
+        flushOutput();
+        newInstrs.push_back(instr);
+        break;
+      default:
+        throw invalid_argument("Unsupported op type in partial evaluator: " + to_string(static_cast<int>(instr.op)));
+    }
+
+    ++IP;
+  }
+
+  return newInstrs;
+}
+
+/**
+ * @brief Removes stores to cells that are overwritten or never read before the program
+ *        ends, going backwards through each stretch of code between loop brackets and memory
+ *        scans, where every cell counts as read.
+ */
+inline vector<Instr> eliminateDeadStores(vector<Instr> instrs, const OptSettings& settings) {
+  vector<Instr> newInstrs;
+  newInstrs.reserve(instrs.size());
+
+  // with allDead, the cells in exceptions are live, otherwise they are dead
+  bool allDead = false;
+  unordered_set<int64_t> exceptions;
+  int64_t pos = 0;
+
+  const auto isDead = [&](const int64_t cell) {
+    return allDead != (exceptions.count(cell) > 0);
+  };
+  const auto markLive = [&](const int64_t cell) {
+    if(allDead)
+      exceptions.insert(cell);
+    else
+      exceptions.erase(cell);
+  };
+  const auto markDead = [&](const int64_t cell) {
+    if(allDead)
+      exceptions.erase(cell);
+    else
+      exceptions.insert(cell);
+  };
+
+  for(auto it = instrs.rbegin(); it != instrs.rend(); ++it) {
+    const Instr& instr = *it;
+    const int64_t cell = pos + instr.offset;
+
+    switch(instr.op) {
+      case MoveRight:
+      case MoveLeft:
+      case AddMemPtr:
+        pos -= pointerDelta(instr);
+        break;
+      case Inc:
+      case Dec:
+      case Sum:
+        if(isDead(cell))
+          continue;
+        break;
+      case Zero:
+        if(isDead(cell))
+          continue;
+        markDead(cell);
+        break;
+      case MulAdd:
+        if(isDead(cell))
+          continue;
+        markLive(pos + instr.srcOffset);
+        break;
+      case Write:
+        markLive(cell);
+        break;
+      case Read:
+        // a Read that may leave its cell unchanged also reads it
+        if(settings.eof == EofBehavior::Unchanged)
+          markLive(cell);
+        else
+          markDead(cell);
+        break;
+      case EndOfFile:
+        allDead = true;
+        exceptions.clear();
+        break;
+      case JumpIfZero:
+      case JumpUnlessZero:
+      case MemScan:
+        allDead = false;
+        exceptions.clear();
+        break;
+      default:
+        break;
+    }
+
+    newInstrs.push_back(instr);
+  }
+
+  reverse(newInstrs.begin(), newInstrs.end());
+  return newInstrs;
+}
+
+/**
+ * @brief Turns Writes of cells with a known value into Prints of string constants added
+ *        to outputs. Consecutive ones become one Print, which goes right before the next
+ *        instruction that does I/O or branches. The stores that only fed them are removed.
+ */
+inline vector<Instr> coalesceWrites(vector<Instr> instrs, const OptSettings& settings, vector<string>& outputs) {
+  if(!settings.coalesceWrites)
+    return instrs;
+
+  vector<Instr> newInstrs;
+  newInstrs.reserve(instrs.size());
+
+  KnownCells known;
+  string pendingOutput;
+
+  for(const auto& instr : instrs) {
+    const Op op = instr.op;
+
+    if(op == Write) {
+      const auto value = known.valueAt(known.pos + instr.offset);
+      if(value) {
+        pendingOutput += static_cast<char>(*value);
+        continue;
+      }
+    }
+
+    const bool flushes = op == Write || op == Read || op == Print || op == JumpIfZero || op == JumpUnlessZero || op == EndOfFile;
+    if(flushes && !pendingOutput.empty()) {
+      newInstrs.push_back(makePrintInstr(static_cast<uint32_t>(outputs.size()), pendingOutput.size()));
+      outputs.push_back(std::move(pendingOutput));
+      pendingOutput.clear();
+    }
+
+    known.apply(instr);
+    newInstrs.push_back(instr);
+  }
+
+  return eliminateDeadStores(std::move(newInstrs), settings);
+}
+
+// Largest pending pointer movement propagateOffsets folds into offsets, so
+// that they fit the interpreter's 16 bit cell offsets
+constexpr int64_t maxPropagatedOffset = INT16_MAX;
+
+/**
+ * @brief Delays pointer movement and folds it into the offset of every instruction that
+ *        touches a cell, including the compares of [ and ]. A loop is entered with whatever
+ *        movement is pending, so an AddMemPtr is only emitted before a ] when the body moves
+ *        the pointer on net, to bring it back to where the [ expects it.
+ *        Should run last, the other passes assume every cell access is at the pointer.
+ */
+inline vector<Instr> propagateOffsets(vector<Instr> instrs, const OptSettings& settings) {
+  if(!settings.propagateOffsets)
+    return instrs;
+
+  vector<Instr> newInstrs;
+  newInstrs.reserve(instrs.size());
+
+  // the tape pointer is at the logical position minus pendingOffset
+  int64_t pendingOffset = 0;
+  // pendingOffset at the [ of every open loop, which its ] has to restore
+  stack<int64_t> loopHeadOffsets;
+
+  const auto movePointerUntil = [&](const int64_t offset) {
+    if(pendingOffset != offset)
+      newInstrs.push_back(makeAddMemPtrInstr(pendingOffset - offset));
+    pendingOffset = offset;
+  };
+
+  for(Instr instr : instrs) {
+    switch(instr.op) {
+      case MoveRight:
+      case MoveLeft:
+      case AddMemPtr: {
+        const int64_t delta = pointerDelta(instr);
+        if(abs(pendingOffset + delta) > maxPropagatedOffset) {
+          movePointerUntil(0);
+          // a single move too large to carry in an offset stays a move
+          if(abs(delta) > maxPropagatedOffset) {
+            newInstrs.push_back(makeAddMemPtrInstr(delta));
+            continue;
+          }
+        }
+        pendingOffset += delta;
+        continue;
+      }
+      case Inc:
+      case Dec:
+        instr = makeSumInstr(cellDelta(instr), 0);
+        break;
+      case JumpIfZero:
+        loopHeadOffsets.push(pendingOffset);
+        break;
+      case JumpUnlessZero:
+        movePointerUntil(loopHeadOffsets.top());
+        loopHeadOffsets.pop();
+        break;
+      case MulAdd:
+        instr.srcOffset = static_cast<int32_t>(pendingOffset);
+        break;
+      default:
+        break;
+    }
+
+    if(instr.op != EndOfFile)
+      instr.offset += static_cast<int32_t>(pendingOffset);
+    newInstrs.push_back(instr);
+  }
+
+  return newInstrs;
+}
+
+// outputs receives the strings of the Prints partialEval and coalesceWrites emit
+inline vector<Instr> optimize(vector<Instr> instrs, const OptSettings& settings, vector<string>& outputs) {
+  auto simplifiedLoops = simplifyLoops(std::move(instrs), settings);
+  auto liveInstrs = eliminateDeadCode(std::move(simplifiedLoops), settings);
+  auto instCombinedInstrs = instCombine(std::move(liveInstrs), settings);
+  auto partialEvaledInstrs = partialEval(std::move(instCombinedInstrs), settings, outputs);
+  auto coalescedInstrs = coalesceWrites(std::move(partialEvaledInstrs), settings, outputs);
+  return propagateOffsets(std::move(coalescedInstrs), settings);
+}
+
+inline bool checkValidInstrs(const vector<OpRun>& ops) {
+  stack<Op> lhsBrackets;
+
+  for(const auto& [op, count] : ops) {
+    if(op == JumpIfZero)
+      lhsBrackets.push(op);
+    else if(op == JumpUnlessZero) {
+      if(lhsBrackets.empty())
+        return false;
+
+      lhsBrackets.pop();
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+// A small x86-64 assembler for the JIT, which writes machine code straight
+// into the code buffer instead of going through text.
+
+// Registers, numbered as in their encoding
+enum Reg : uint8_t {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Conditions, as the low nibble of the jcc opcode
+enum Cond : uint8_t {
+  Equal = 0x4,
+  NotEqual = 0x5,
+};
+
+/**
+ * @brief Writes x86-64 instructions at a cursor in a code buffer. Memory operands are
+ *        [base+disp], in the shortest encoding for the displacement. Jumps and calls take
+ *        either an address or a Label. A jump to a Label that is not bound yet leaves its
+ *        rel32 field to be fixed up when the Label is bound.
+ */
+class X86Emitter {
+public:
+  class Label {
+  public:
+    bool isBound() const { return address != nullptr; }
+    unsigned char* target() const { return address; }
+
+  private:
+    friend class X86Emitter;
+    unsigned char* address {nullptr};
+    vector<unsigned char*> fixups;
+  };
+
+  explicit X86Emitter(unsigned char* const start) : cursor(start) {}
+
+  unsigned char* position() const { return cursor; }
+
+  void push(const Reg reg) {
+    rex(false, 0, reg);
+    byte(0x50 + (reg & 7));
+  }
+  void pop(const Reg reg) {
+    rex(false, 0, reg);
+    byte(0x58 + (reg & 7));
+  }
+  void ret() { byte(0xc3); }
+  void nops(const size_t count) {
+    for(size_t i = 0; i < count; ++i)
+      byte(0x90);
+  }
+
+  // mov dst, src
+  void mov(const Reg dst, const Reg src) {
+    rex(true, src, dst);
+    byte(0x89);
+    registerOperand(src, dst);
+  }
+  // movabs reg, imm
+  void movImm64(const Reg reg, const uint64_t imm) {
+    rex(true, 0, reg);
+    byte(0xb8 + (reg & 7));
+    raw(imm);
+  }
+  // mov reg, imm, sign extended
+  void movImm32(const Reg reg, const int32_t imm) {
+    rex(true, 0, reg);
+    byte(0xc7);
+    registerOperand(0, reg);
+    raw(imm);
+  }
+  // lea dst, [base+disp]
+  void lea(const Reg dst, const Reg base, const int32_t disp) {
+    rex(true, dst, base);
+    byte(0x8d);
+    memoryOperand(dst, base, disp);
+  }
+  // add reg, imm
+  void add(const Reg reg, const int32_t imm) {
+    rex(true, 0, reg);
+    if(fitsInt8(imm)) {
+      byte(0x83);
+      registerOperand(0, reg);
+      raw(static_cast<int8_t>(imm));
+    }
+    else {
+      byte(0x81);
+      registerOperand(0, reg);
+      raw(imm);
+    }
+  }
+  // sub reg, imm
+  void sub(const Reg reg, const int32_t imm) {
+    rex(true, 0, reg);
+    if(fitsInt8(imm)) {
+      byte(0x83);
+      registerOperand(5, reg);
+      raw(static_cast<int8_t>(imm));
+    }
+    else {
+      byte(0x81);
+      registerOperand(5, reg);
+      raw(imm);
+    }
+  }
+  void inc(const Reg reg) {
+    rex(true, 0, reg);
+    byte(0xff);
+    registerOperand(0, reg);
+  }
+  void dec(const Reg reg) {
+    rex(true, 0, reg);
+    byte(0xff);
+    registerOperand(1, reg);
+  }
+  // imul dst32, src32, imm
+  void imul(const Reg dst, const Reg src, const int32_t imm) {
+    rex(false, dst, src);
+    byte(0x69);
+    registerOperand(dst, src);
+    raw(imm);
+  }
+  // call reg
+  void call(const Reg reg) {
+    rex(false, 0, reg);
+    byte(0xff);
+    registerOperand(2, reg);
+  }
+
+  // movzx dst32, BYTE PTR [base+disp]
+  void movzxByte(const Reg dst, const Reg base, const int32_t disp) {
+    rex(false, dst, base);
+    byte(0x0f);
+    byte(0xb6);
+    memoryOperand(dst, base, disp);
+  }
+  // mov BYTE PTR [base+disp], imm
+  void movByte(const Reg base, const int32_t disp, const uint8_t imm) {
+    rex(false, 0, base);
+    byte(0xc6);
+    memoryOperand(0, base, disp);
+    byte(imm);
+  }
+  // add BYTE PTR [base+disp], imm
+  void addByte(const Reg base, const int32_t disp, const uint8_t imm) {
+    rex(false, 0, base);
+    byte(0x80);
+    memoryOperand(0, base, disp);
+    byte(imm);
+  }
+  // add BYTE PTR [base+disp], src8, where src is one of al, cl, dl and bl
+  void addByte(const Reg base, const int32_t disp, const Reg src) {
+    if(src > RBX)
+      throw invalid_argument("Only al, cl, dl and bl can be added without a REX prefix");
+    rex(false, src, base);
+    byte(0x00);
+    memoryOperand(src, base, disp);
+  }
+  // cmp BYTE PTR [base+disp], imm
+  void cmpByte(const Reg base, const int32_t disp, const uint8_t imm) {
+    rex(false, 0, base);
+    byte(0x80);
+    memoryOperand(7, base, disp);
+    byte(imm);
+  }
+  void incByte(const Reg base, const int32_t disp) {
+    rex(false, 0, base);
+    byte(0xfe);
+    memoryOperand(0, base, disp);
+  }
+  void decByte(const Reg base, const int32_t disp) {
+    rex(false, 0, base);
+    byte(0xfe);
+    memoryOperand(1, base, disp);
+  }
+  // mov DWORD PTR [base+disp], imm
+  void movDword(const Reg base, const int32_t disp, const uint32_t imm) {
+    rex(false, 0, base);
+    byte(0xc7);
+    memoryOperand(0, base, disp);
+    raw(imm);
+  }
+
+  void jmp(const unsigned char* const target) {
+    byte(0xe9);
+    rel32(target);
+  }
+  void jmp(Label& label) {
+    byte(0xe9);
+    rel32(label);
+  }
+  void jcc(const Cond cond, const unsigned char* const target) {
+    byte(0x0f);
+    byte(0x80 | cond);
+    rel32(target);
+  }
+  void jcc(const Cond cond, Label& label) {
+    byte(0x0f);
+    byte(0x80 | cond);
+    rel32(label);
+  }
+
+  // Binds label to the cursor and fixes up the jumps emitted to it so far
+  void bind(Label& label) {
+    if(label.isBound())
+      throw invalid_argument("Label is already bound");
+    label.address = cursor;
+    for(unsigned char* const field : label.fixups)
+      patchRel32(field, cursor);
+    label.fixups.clear();
+  }
+
+private:
+  static bool fitsInt8(const int64_t value) { return value >= INT8_MIN && value <= INT8_MAX; }
+
+  static void patchRel32(unsigned char* const field, const unsigned char* const target) {
+    const int64_t distance = target - (field + 4);
+    if(distance < INT32_MIN || distance > INT32_MAX)
+      throw out_of_range("Jump target is out of rel32 range");
+    const auto rel = static_cast<int32_t>(distance);
+    memcpy(field, &rel, sizeof(rel));
+  }
+
+  void byte(const unsigned value) { *cursor++ = static_cast<unsigned char>(value); }
+
+  template<typename T>
+  void raw(const T value) {
+    memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
+  }
+
+  void rel32(const unsigned char* const target) {
+    patchRel32(cursor, target);
+    cursor += 4;
+  }
+  void rel32(Label& label) {
+    if(label.isBound())
+      return rel32(label.target());
+    label.fixups.push_back(cursor);
+    raw(int32_t{0});
+  }
+
+  // REX prefix, left out when nothing needs it
+  void rex(const bool wide, const unsigned reg, const unsigned rm) {
+    const unsigned prefix = 0x40 | (wide ? 0x8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+    if(prefix != 0x40)
+      byte(prefix);
+  }
+
+  void registerOperand(const unsigned reg, const unsigned rm) {
+    byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  void memoryOperand(const unsigned reg, const Reg base, const int32_t disp) {
+    // rbp and r13 as a base always take a displacement, rsp and r12 need a SIB byte
+    const unsigned mod = (disp == 0 && (base & 7) != RBP) ? 0 : fitsInt8(disp) ? 1 : 2;
+    byte((mod << 6) | ((reg & 7) << 3) | (base & 7));
+    if((base & 7) == RSP)
+      byte(0x24);
+    if(mod == 1)
+      raw(static_cast<int8_t>(disp));
+    else if(mod == 2)
+      raw(disp);
+  }
+
+  unsigned char* cursor;
+};